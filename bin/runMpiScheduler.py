@@ -0,0 +1,88 @@
+#! /usr/bin/env python
+
+# 
+# LSST Data Management System
+# Copyright 2008, 2009, 2010 LSST Corporation.
+# 
+# This product includes software developed by the
+# LSST Project (http://www.lsst.org/).
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+# 
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# 
+# You should have received a copy of the LSST License Statement and 
+# the GNU General Public License along with this program.  If not, 
+# see <http://www.lsstcorp.org/LegalNotices/>.
+#
+
+
+"""
+Usage: runMpiScheduler.py [-c capacity] [-r reserve]
+
+Run the SliceScheduler that shares one pool of Slice cores among several
+Pipelines launched by the same mpiexec.  This script should only be launched
+via runSharedPipelines.sh.
+"""
+from lsst.pex.mpiharness.mpiharnessLib import SliceScheduler
+from lsst.pex.logging import Log
+
+import sys
+import optparse, traceback
+
+usage = """Usage: %prog [-c capacity] [-r reserve]"""
+desc = """Arbitrate a shared pool of Slice cores among the Pipelines started
+by the same mpiexec.  This should not be executed outside the context of a
+pipeline harness process.
+"""
+
+cl = optparse.OptionParser(usage=usage, description=desc)
+cl.add_option("-c", "--capacity", type="int", action="store",
+              dest="capacity", default=None, metavar="n",
+              help="the number of Slice cores in the shared pool")
+cl.add_option("-r", "--reserve", type="int", action="store",
+              dest="reserve", default=0, metavar="n",
+              help="the number of Slice cores held for visits of priority above 0")
+
+def main():
+    """parse the input arguments and run the scheduler
+    """
+
+    (cl.opts, cl.args) = cl.parse_args()
+
+    runScheduler(cl.opts.capacity, cl.opts.reserve)
+
+def runScheduler(capacity=None, reserve=0):
+    """
+    runScheduler: SliceScheduler Main execution
+    @param capacity   the number of Slice cores in the pool; by default the
+                         universe size less the processes started by mpiexec
+    @param reserve    the number of Slice cores held for Pipelines working
+                         on visits of priority above 0
+    """
+    scheduler = SliceScheduler()
+    if isinstance(capacity, int):
+        scheduler.setCapacity(capacity)
+    scheduler.setReserve(reserve)
+
+    scheduler.initialize()
+
+    scheduler.run()
+
+    scheduler.shutdown()
+
+
+if (__name__ == '__main__'):
+    try:
+        main()
+    except Exception, e:
+        log = Log(Log.getDefaultLog(),"runScheduler")
+        log.log(Log.FATAL, str(e))
+        traceback.print_exc(file=sys.stderr)
+        sys.exit(2);
@@ -39,7 +39,7 @@ import os
 import sys
 import optparse, traceback
 
-usage = """Usage: %prog [-l lev] [-n name] policy runID"""
+usage = """Usage: %prog [-l lev] [-n name] [-w threads] [-t level] [-g size] [-a strategy] [-s] [-q] policy runID"""
 desc = """Execute a slice worker process for a pipeline described by the
 given policy, assigning it the given run ID.  This should not be executed
 outside the context of a pipline harness process.  
@@ -51,6 +51,24 @@ cl.add_option("-l", "--log-threshold", type="int", action="store",
               help="the logging message level threshold")
 cl.add_option("-n", "--name", action="store", default=None, dest="name",
               help="a name for identifying the pipeline")
+cl.add_option("-w", "--threads", type="int", action="store",
+              dest="threads", default=None, metavar="n",
+              help="the number of threads in the Slice ThreadPool")
+cl.add_option("-t", "--thread-level", action="store",
+              dest="threadlevel", default=None, metavar="level",
+              help="the MPI thread level: single, funneled, serialized or multiple")
+cl.add_option("-g", "--control-group", type="int", action="store",
+              dest="controlgroup", default=None, metavar="size",
+              help="the size of the Slice groups of the control tree; 0 groups by node")
+cl.add_option("-a", "--affinity", action="store",
+              dest="affinity", default=None, metavar="strategy",
+              help="pin the Slice to cores: none, compact, scatter or numa")
+cl.add_option("-s", "--shared-pool", action="store_true",
+              dest="sharedpool", default=False,
+              help="the Slice pool is shared with other pipelines")
+cl.add_option("-q", "--visit-queue", action="store_true",
+              dest="visitqueue", default=False,
+              help="the pipeline sends each Slice its work units ahead")
 
 def main():
     """parse the input arguments and execute the pipeline
@@ -67,16 +85,21 @@ def main():
     pipelinePolicyName = cl.args[0]
     runId = cl.args[1]
 
-    runSlice(pipelinePolicyName, runId, cl.opts.logthresh, cl.opts.name)
+    runSlice(pipelinePolicyName, runId, cl.opts.logthresh, cl.opts.name,
+             cl.opts.threadlevel, cl.opts.threads, cl.opts.controlgroup,
+             cl.opts.affinity, cl.opts.sharedpool, cl.opts.visitqueue)
 
-def runSlice(policyFile, runId, logthresh=None, name="unnamed"):
+def runSlice(policyFile, runId, logthresh=None, name="unnamed",
+             threadLevel=None, nThreads=None, controlGroupSize=None,
+             affinity=None, sharedPool=False, visitQueue=False):
     """
     runSlice: MpiSlice Main execution 
     """
     if name is None or name == "None":
         name = os.path.splitext(os.path.basename(policyFile))[0]
     
-    pySlice = MpiSlice(runId, policyFile, name)
+    pySlice = MpiSlice(runId, policyFile, name, threadLevel, nThreads,
+                       controlGroupSize, affinity, sharedPool, visitQueue)
     if isinstance(logthresh, int):
         pySlice.setLogThreshold(logthresh)
 
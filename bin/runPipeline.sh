@@ -11,7 +11,7 @@ echo $0 $@
 if [ "$#" -lt 5 ]; then
    echo "---------------------------------------------------------------------"
    echo "Usage:  $0 <policy-file-name> <runId> <nodelist-file>" \
-        "<node-count> <proc-count> [ <verbsity> ] [ <name> ]"
+        "<node-count> <proc-count> [ <verbsity> ] [ <name> ] [ <pipeline-count> ]"
    echo "---------------------------------------------------------------------"
    exit 0
 fi
@@ -23,14 +23,16 @@ nodes=${4}
 usize=${5}
 verbosity=${6}
 name=${7}
+npipelines=${8:-1}
 
 localnode=`hostname | sed -e 's/\..*$//'`
 localncpus=`sed -e 's/#.*$//' $nodelist | egrep $localnode'|localhost' | sed -e 's/^.*://'`
 
-# Subtract 1 to the number of slices to get the universe size 
-nslices=$(( $usize - 1 ))
+# Subtract the Pipeline ranks to the number of slices to get the universe size 
+nslices=$(( $usize - $npipelines ))
 
 echo "nodes ${nodes}"
+echo "npipelines ${npipelines}"
 echo "nslices ${nslices}"
 echo "usize ${usize}"
 echo "ncpus ${localncpus}"
@@ -61,8 +63,8 @@ sleep 2s
 
 echo "Running mpiexec"
 
-echo mpiexec -usize ${usize} -machinefile ${nodelist} -np 1 -envall runMpiPipeline.py ${pipelinePolicyName} ${runId} ${verbosity} ${name} 
-mpiexec -usize ${usize}  -machinefile ${nodelist} -np 1 -envall runMpiPipeline.py ${pipelinePolicyName} ${runId} ${verbosity} ${name} 
+echo mpiexec -usize ${usize} -machinefile ${nodelist} -np ${npipelines} -envall runMpiPipeline.py ${pipelinePolicyName} ${runId} ${verbosity} ${name} 
+mpiexec -usize ${usize}  -machinefile ${nodelist} -np ${npipelines} -envall runMpiPipeline.py ${pipelinePolicyName} ${runId} ${verbosity} ${name} 
 
 sleep 1s
 
@@ -0,0 +1,67 @@
+#!/bin/sh
+
+pwd=`pwd`
+
+# Command line arguments 
+echo $0 $@  
+if [ "$#" -lt 5 ]; then
+   echo "---------------------------------------------------------------------"
+   echo "Usage:  $0 <nodelist-file> <node-count> <proc-count> <runId>" \
+        "<policy-file> [ <policy-file> ... ]"
+   echo "---------------------------------------------------------------------"
+   exit 0
+fi
+
+nodelist=${1}
+nodes=${2}
+usize=${3}
+runId=${4}
+shift 4
+
+localnode=`hostname | sed -e 's/\..*$//'`
+localncpus=`sed -e 's/#.*$//' $nodelist | egrep $localnode'|localhost' | sed -e 's/^.*://'`
+
+# One scheduler process plus one process per Pipeline; each Pipeline spawns
+# its Slices over the remainder of the universe 
+npipelines=$#
+nslices=$(( $usize - $npipelines - 1 ))
+
+echo "nodes ${nodes}"
+echo "npipelines ${npipelines}"
+echo "nslices ${nslices}"
+echo "usize ${usize}"
+echo "ncpus ${localncpus}"
+
+# The Slices of all Pipelines oversubscribe the cores; let MPI yield the 
+# core while a process waits (MPICH and Open MPI respectively) 
+export MPIR_CVAR_POLLS_BEFORE_YIELD=1
+export OMPI_MCA_mpi_yield_when_idle=1
+
+# SLICE_RESERVE Slices of the pool may be held for urgent visits
+apps="-np 1 -envall runMpiScheduler.py -r ${SLICE_RESERVE:-0}"
+for pipelinePolicyName in "$@"; do
+   apps="${apps} : -np 1 -envall runMpiPipeline.py ${pipelinePolicyName} ${runId}"
+done
+
+# MPI commands will be in PATH if mpich2 is in build
+echo "Running mpdboot"
+
+echo mpdboot --totalnum=${nodes} --file=$nodelist --ncpus=$localncpus --verbose
+mpdboot --totalnum=${nodes} --file=$nodelist --ncpus=$localncpus --verbose
+
+sleep 3s
+echo "Running mpdtrace"
+echo mpdtrace -l
+mpdtrace -l
+sleep 2s
+
+echo "Running mpiexec"
+
+echo mpiexec -usize ${usize} -machinefile ${nodelist} ${apps}
+mpiexec -usize ${usize} -machinefile ${nodelist} ${apps}
+
+sleep 1s
+
+echo "Running mpdallexit"
+echo mpdallexit
+mpdallexit
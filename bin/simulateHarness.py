@@ -0,0 +1,441 @@
+#! /usr/bin/env python
+
+#
+# LSST Data Management System
+# Copyright 2008, 2009, 2010 LSST Corporation.
+#
+# This product includes software developed by the
+# LSST Project (http://www.lsst.org/).
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the LSST License Statement and
+# the GNU General Public License along with this program.  If not,
+# see <http://www.lsstcorp.org/LegalNotices/>.
+#
+
+
+"""
+Usage: simulateHarness.py [options] traceFile
+
+Replay the traces of a recorded run, as written with the traceFile policy
+setting, and predict the visit time of the same pipeline on other numbers of
+Slices, topologies and control settings.  The traces of one run are
+<traceFile>.pipeline and <traceFile>.slice<rank>.  Neither MPI nor the LSST
+stack is needed.
+"""
+from __future__ import print_function
+
+import glob
+import math
+import optparse
+import os
+import re
+import sys
+import heapq
+
+usage = """Usage: %prog [options] traceFile"""
+desc = """Predict the visit time of a pipeline on other numbers of Slices from
+the traces of a recorded run.  traceFile is the traceFile policy setting of
+that run."""
+
+def parseTrace(filename):
+    """
+    Read a trace file written by TraceBuffer.dump() and return its records
+    as (time, event, rank, stage, arg1, arg2) tuples in time order.
+    """
+    records = []
+    for line in open(filename):
+        fields = line.split()
+        if len(fields) != 8 or fields[2] != "rank" or fields[4] != "stage":
+            continue
+        records.append((float(fields[0]), fields[1], int(fields[3]),
+                        int(fields[5]), int(fields[6]), int(fields[7])))
+    records.sort()
+    return records
+
+def splitVisits(records):
+    """
+    Split trace records into visits at each visit-begin.  Records before the
+    first visit-begin, e.g. those of a visit partly overwritten in the ring
+    buffer, are dropped.
+    """
+    visits = []
+    for rec in records:
+        if rec[1] == "visit-begin":
+            visits.append([])
+        if visits:
+            visits[-1].append(rec)
+    return visits
+
+class Visit(object):
+    """
+    The measured costs of one visit: per Stage, the serial pre- and
+    postprocess times, the compute time of each Slice and the size of the
+    PropertySet each Slice sent in the syncSlices before the Stage.
+    """
+    def __init__(self):
+        self.begin = None
+        self.end = None
+        self.stages = []
+        self.pre = {}
+        self.post = {}
+        self.process = {}
+        self.compute = {}
+        self.syncBytes = {}
+        self.syncTime = {}
+
+    def addPipeline(self, records):
+        begins = {}
+        pendingSync = None
+        for (time, event, rank, stage, arg1, arg2) in records:
+            if event == "visit-begin":
+                self.begin = time
+            self.end = time
+            if event.endswith("-begin"):
+                begins[event[:-6]] = time
+            if event == "sync-end" and "sync" in begins:
+                pendingSync = time - begins["sync"]
+            elif event == "preprocess-end" and "preprocess" in begins:
+                self.pre[stage] = time - begins["preprocess"]
+            elif event == "postprocess-end" and "postprocess" in begins:
+                self.post[stage] = time - begins["postprocess"]
+            elif event == "process-end" and "process" in begins:
+                self.process[stage] = time - begins["process"]
+                self.stages.append(stage)
+                if pendingSync is not None:
+                    self.syncTime[stage] = pendingSync
+                    pendingSync = None
+
+    def addSlice(self, rank, records):
+        start = {}
+        syncBytes = None
+        for (time, event, r, stage, arg1, arg2) in records:
+            if event == "sync-posted":
+                syncBytes = arg1
+            elif event == "bcast-end":
+                start[stage] = time
+                if syncBytes is not None:
+                    self.syncBytes.setdefault(stage, []).append(syncBytes)
+                    syncBytes = None
+            elif stage in start and ((event == "unit-done" and arg1 == rank) or
+                                     event == "barrier-begin"):
+                self.compute.setdefault(stage, {})[rank] = time - start.pop(stage)
+
+    def getTime(self):
+        return self.end - self.begin
+
+def loadVisits(prefix):
+    """
+    Read <prefix>.pipeline and <prefix>.slice<rank> and return the number of
+    Slices and the Visits found in all of them.
+    """
+    pipelineFile = prefix + ".pipeline"
+    if not os.path.exists(pipelineFile):
+        raise RuntimeError("no trace %s" % pipelineFile)
+    pipelineVisits = splitVisits(parseTrace(pipelineFile))
+
+    sliceFiles = {}
+    for name in glob.glob(prefix + ".slice*"):
+        match = re.match(r".*\.slice(\d+)$", name)
+        if match:
+            sliceFiles[int(match.group(1))] = name
+    if not sliceFiles:
+        raise RuntimeError("no Slice traces %s.slice<rank>" % prefix)
+    sliceVisits = {}
+    for rank in sliceFiles:
+        sliceVisits[rank] = splitVisits(parseTrace(sliceFiles[rank]))
+
+    # The ring buffers keep the most recent visits; align them at the end
+    nVisits = min([len(pipelineVisits)] + [len(v) for v in sliceVisits.values()])
+    visits = []
+    for i in range(nVisits):
+        visit = Visit()
+        visit.addPipeline(pipelineVisits[len(pipelineVisits) - nVisits + i])
+        for rank in sliceVisits:
+            visit.addSlice(rank, sliceVisits[rank][len(sliceVisits[rank]) - nVisits + i])
+        if visit.stages:
+            visits.append(visit)
+
+    # The last visit ends at shutdown rather than at the next visit-begin
+    for i in range(len(visits) - 1):
+        visits[i].end = visits[i + 1].begin
+    return len(sliceFiles), visits
+
+def log2ceil(n):
+    if n <= 1:
+        return 0
+    return int(math.ceil(math.log(n) / math.log(2)))
+
+def median(values):
+    ordered = sorted(values)
+    return ordered[len(ordered) // 2]
+
+class Model(object):
+    """
+    The cost model.  A control command costs one latency per level of the
+    broadcast tree; a syncSlices costs two commands plus the receipt of the
+    neighbor PropertySets; the parallel part of a Stage ends with the
+    slowest Slice, or with the speculative copy that replaces it.
+    """
+    def __init__(self, opts):
+        self.opts = opts
+
+    def groupSize(self, nSlices):
+        if self.opts.groupSize > 0:
+            return self.opts.groupSize
+        return max(1, min(self.opts.slicesPerNode, nSlices))
+
+    def controlCost(self, nSlices):
+        if self.opts.control == "flat":
+            depth = log2ceil(nSlices + 1)
+        else:
+            group = self.groupSize(nSlices)
+            leaders = (nSlices + group - 1) // group
+            depth = log2ceil(leaders + 1) + log2ceil(group)
+        return self.opts.latency * depth
+
+    def receiveCount(self):
+        topology = self.opts.topology
+        if topology == "ring":
+            return 1
+        if topology == "focalplane":
+            return 4
+        if topology == "sliceleaders":
+            return max(0, self.opts.param1 - 1)
+        return 0
+
+    def syncCost(self, nSlices, nBytes):
+        nRecv = self.receiveCount()
+        if nRecv == 0:
+            return 0.0
+        return (2 * self.controlCost(nSlices) + self.opts.latency +
+                nRecv * nBytes / self.opts.bandwidth)
+
+    def sliceTimes(self, measured, nSlices):
+        """
+        Scale the measured compute times of M Slices to N Slices.  Slice i
+        takes the profile of recorded Slice i mod M.  Under strong scaling
+        the work of the visit is shared by the N Slices; under weak scaling
+        each Slice keeps the work of its recorded Slice.
+        """
+        ranks = sorted(measured.keys())
+        times = [measured[ranks[i % len(ranks)]] for i in range(nSlices)]
+        if self.opts.scaling == "strong" and sum(times) > 0:
+            scale = sum(measured.values()) / sum(times)
+            times = [t * scale for t in times]
+        return times
+
+    def parallelTime(self, times):
+        if self.opts.dispatch == "speculative":
+            return speculate(times, self.opts.threshold, self.opts.factor)
+        return max(times)
+
+    def visitTime(self, visit, nSlices):
+        total = 0.0
+        if self.opts.handshake:
+            total += self.controlCost(nSlices)             # CONTINUE
+        for stage in visit.stages:
+            total += visit.pre.get(stage, 0.0) + visit.post.get(stage, 0.0)
+            total += 3 * self.controlCost(nSlices)         # RUN, stage, barrier
+            if stage in visit.syncBytes:
+                nBytes = float(sum(visit.syncBytes[stage])) / len(visit.syncBytes[stage])
+                total += self.syncCost(nSlices, nBytes)
+            if stage in visit.compute:
+                total += self.parallelTime(self.sliceTimes(visit.compute[stage], nSlices))
+        return total
+
+def speculate(times, threshold, factor):
+    """
+    Replay Pipeline::trackWorkUnits() on work units that take the given
+    times.  A copy of a straggling unit is assumed to take the median time
+    of the units done so far.
+    @return the time at which every work unit has been done once
+    """
+    n = len(times)
+    events = [(times[i], i, i) for i in range(n)]
+    heapq.heapify(events)
+    running = dict([(i, i) for i in range(n)])
+    copies = [1] * n
+    done = [False] * n
+    durations = []
+    idle = []
+    now = 0.0
+
+    while len(durations) < n:
+        launch = None
+        if idle and len(durations) >= threshold * n:
+            typical = median(durations)
+            when = max(now, factor * typical)
+            unit = -1
+            for i in range(n):
+                if not done[i] and copies[i] == 1:
+                    unit = i
+                    break
+            if unit >= 0 and (not events or when < events[0][0]):
+                launch = (when, unit, typical)
+
+        if launch is not None:
+            (now, unit, typical) = launch
+            slice = idle.pop()
+            running[slice] = unit
+            copies[unit] += 1
+            heapq.heappush(events, (now + typical, unit, slice))
+            continue
+
+        (now, unit, slice) = heapq.heappop(events)
+        if running.get(slice) != unit:
+            continue                                # a cancelled copy
+        if not done[unit]:
+            done[unit] = True
+            durations.append(now)
+            for other in list(running.keys()):
+                if other != slice and running[other] == unit:
+                    del running[other]
+                    copies[unit] -= 1
+                    idle.append(other)
+        copies[unit] -= 1
+        del running[slice]
+        idle.append(slice)
+
+    return max(durations)
+
+def parseSlices(text):
+    """
+    Parse a list of Slice counts such as "1,2,4-64": a range doubles.
+    """
+    counts = []
+    for item in text.split(","):
+        if "-" in item:
+            (first, last) = [int(x) for x in item.split("-")]
+            n = first
+            while n <= last:
+                counts.append(n)
+                n *= 2
+        elif item:
+            counts.append(int(item))
+    return sorted(set(counts))
+
+def main():
+    parser = optparse.OptionParser(usage=usage, description=desc)
+    parser.add_option("-n", "--slices", default="1-1024",
+                      help="the Slice counts to predict, e.g. 1,2,4-64 (default: 1-1024)")
+    parser.add_option("-t", "--topology", default=None,
+                      help="syncSlices topology: none, ring, focalplane or sliceleaders "
+                           "(default: ring if the run synchronized, else none)")
+    parser.add_option("-p", "--param1", type="int", default=2,
+                      help="the sliceleaders modulus (default: 2)")
+    parser.add_option("-g", "--group-size", type="int", dest="groupSize", default=0,
+                      help="the controlGroupSize of the control tree (default: slices per node)")
+    parser.add_option("-s", "--slices-per-node", type="int", dest="slicesPerNode", default=8,
+                      help="Slices per node, the default control group (default: 8)")
+    parser.add_option("-c", "--control", default="tree", choices=["tree", "flat"],
+                      help="tree, through node leaders, or flat (default: tree)")
+    parser.add_option("-H", "--handshake", action="store_true", default=False,
+                      help="start each visit with a CONTINUE broadcast, as when the first Stage waits for an event")
+    parser.add_option("-d", "--dispatch", default="barrier", choices=["barrier", "speculative"],
+                      help="barrier, or speculative re-execution of stragglers (default: barrier)")
+    parser.add_option("--threshold", type="float", default=0.75,
+                      help="speculationThreshold (default: 0.75)")
+    parser.add_option("--factor", type="float", default=1.5,
+                      help="speculationFactor (default: 1.5)")
+    parser.add_option("-l", "--latency", type="float", default=20e-6,
+                      help="seconds per message (default: 20e-6)")
+    parser.add_option("-C", "--calibrate", action="store_true", default=False,
+                      help="fit the latency so that the model matches the recorded run")
+    parser.add_option("-b", "--bandwidth", type="float", default=1e9,
+                      help="bytes per second between Slices (default: 1e9)")
+    parser.add_option("-S", "--scaling", default="strong", choices=["strong", "weak"],
+                      help="strong: the visit's work is shared by the Slices; "
+                           "weak: each Slice keeps its work (default: strong)")
+    parser.add_option("-m", "--min-gain", type="float", dest="minGain", default=0.05,
+                      help="the fractional increase in speedup below which more Slices "
+                           "do not pay off "
+                           "(default: 0.05)")
+    (opts, args) = parser.parse_args()
+
+    if len(args) != 1:
+        parser.print_usage()
+        return 1
+
+    try:
+        (nRecorded, visits) = loadVisits(args[0])
+    except (RuntimeError, IOError) as e:
+        print("simulateHarness.py: %s" % e, file=sys.stderr)
+        return 1
+    if not visits:
+        print("simulateHarness.py: no complete visits in the traces", file=sys.stderr)
+        return 1
+
+    if opts.topology is None:
+        synced = [v for v in visits if v.syncBytes]
+        opts.topology = (synced and "ring") or "none"
+
+    model = Model(opts)
+
+    def predict(nSlices):
+        return sum([model.visitTime(v, nSlices) for v in visits]) / len(visits)
+
+    measured = sum([v.getTime() for v in visits]) / len(visits)
+
+    # The model is linear in the latency: fit it to the recorded run
+    if opts.calibrate:
+        opts.latency = 0.0
+        t0 = predict(nRecorded)
+        opts.latency = 1.0
+        t1 = predict(nRecorded)
+        opts.latency = 0.0
+        if t1 > t0 and measured > t0:
+            opts.latency = (measured - t0) / (t1 - t0)
+        print("Calibrated latency: %.3g s per message" % opts.latency)
+
+    print("Recorded %d Slices, %d visits: measured %.6f s per visit, modelled %.6f s" %
+          (nRecorded, len(visits), measured, predict(nRecorded)))
+    print("Model: %s scaling, %s control, %s dispatch, topology %s" %
+          (opts.scaling, opts.control, opts.dispatch, opts.topology))
+    print("")
+    rows = []
+    base = predict(1)
+    for n in parseSlices(opts.slices):
+        t = predict(n)
+        speedup = base / t
+        if opts.scaling == "weak":
+            speedup *= n
+        gain = None
+        if rows:
+            gain = speedup / rows[-1][2] - 1.0
+        rows.append((n, t, speedup, gain))
+
+    # Adding Slices stops paying off once no later step gains minGain
+    knee = None
+    for (n, t, speedup, gain) in reversed(rows):
+        if gain is None or gain >= opts.minGain:
+            break
+        knee = n
+
+    print("%8s %14s %10s %10s %10s" % ("slices", "visit (s)", "speedup", "efficiency", "gain"))
+    for (n, t, speedup, gain) in rows:
+        text = ""
+        if gain is not None:
+            text = "%.1f%%" % (100.0 * gain)
+        flag = ""
+        if knee is not None and n >= knee:
+            flag = "  *"
+        print("%8d %14.6f %10.2f %10.2f %10s%s" % (n, t, speedup, speedup / n, text, flag))
+
+    if knee is not None:
+        print("")
+        print("* from %d Slices on, each step adds less than %.0f%% to the speedup" %
+              (knee, 100.0 * opts.minGain))
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
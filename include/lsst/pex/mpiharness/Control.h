@@ -0,0 +1,126 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file Control.h
+  *
+  * \ingroup harness
+  *
+  * \brief   Constants shared by the Pipeline and the Slices on the control path.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#ifndef LSST_PEX_MPIHARNESS_CONTROL_H
+#define LSST_PEX_MPIHARNESS_CONTROL_H
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/** Tag used to build the intercommunicator between the Pipeline and the
+ * node-leader Slices of the control tree.
+ */
+const int CONTROL_TREE_TAG = 7302;
+
+/** Tag of the messages that track the work units of a speculative Stage.
+ */
+const int SPECULATION_TAG = 7303;
+
+/** Tag of the reports that end a Stage: sent by each node-leader Slice to
+ * the root of the Pipeline once every Slice of its group is done, and 
+ * passed on by the root to the other Pipeline ranks.
+ */
+const int CONTROL_DONE_TAG = 7304;
+
+/** Tag of the control messages the root of the Pipeline sends to every
+ * Slice when an operator changes something: "PAUSE", "RESUME", "DRAIN" or
+ * "LOGLEVEL <threshold>".  A Slice keeps a receive posted for them.
+ */
+const int CONTROL_MESSAGE_TAG = 7305;
+
+/** Size of a control message, including the terminating null.
+ */
+const int CONTROL_MESSAGE_SIZE = 64;
+
+/** Tag of the work unit descriptors the root of the Pipeline sends to each
+ * Slice, as a packed PropertySet holding the number of the visit, when the
+ * visit queue is on.
+ */
+const int VISIT_PREFETCH_TAG = 7306;
+
+/** Tag of the empty messages that announce a command or a report when the
+ * Slice pool is shared: the root of the Pipeline sends one to each node 
+ * leader before every command, which passes it on to its group, and each
+ * Slice sends one to its leader before the report that ends a Stage.  An 
+ * idle Slice waits for them asleep rather than polling inside a collective.
+ */
+const int CONTROL_WAKE_TAG = 7307;
+
+/** The fields of the report a Slice sends at the end of a Stage, which the
+ * Pipeline reduces to the largest value of each over all Slices: the 
+ * seconds the Slice waited for the command of the Stage and then took to 
+ * process it; and, when memory is accounted, the resident size of the 
+ * Slice at the start and at the end of the Stage and its peak during the
+ * Stage, in MB, and the fraction of the memory of its node in use.
+ */
+enum StageReport {
+    REPORT_RSS_BEGIN = 0,
+    REPORT_RSS_END,
+    REPORT_PEAK_RSS,
+    REPORT_NODE_USED,
+    REPORT_COMMAND_WAIT,
+    REPORT_PROCESS_TIME,
+    REPORT_FIELDS
+};
+
+/** One field of a Stage report, laid out as MPI_DOUBLE_INT so that the
+ * reports of the Slices can be reduced with MPI_MAXLOC; rank is the Slice
+ * that holds the largest value.
+ */
+struct ReportLoc {
+    double value;
+    int rank;
+};
+
+/** Messages of a speculative Stage, sent as { sequence, work unit, op }.
+ * A Slice reports each work unit it completes (DONE) or whose copy failed
+ * (FAILED); the Pipeline hands
+ * an idle Slice a copy of a straggler's work unit (RUN), tells the Slice
+ * running the losing copy to give up (CANCEL), and ends the Stage (END).
+ */
+enum SpeculationOp {
+    SPECULATION_DONE = 1,
+    SPECULATION_FAILED,
+    SPECULATION_RUN,
+    SPECULATION_CANCEL,
+    SPECULATION_END
+};
+
+} // namespace mpiharness
+
+} // namespace pex
+
+} // namespace lsst
+
+#endif // LSST_PEX_MPIHARNESS_CONTROL_H
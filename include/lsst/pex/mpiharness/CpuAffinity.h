@@ -0,0 +1,84 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file CpuAffinity.h
+  *
+  * \ingroup harness
+  *
+  * \brief   CpuAffinity places a Slice on the cores and NUMA memory of its node.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#ifndef LSST_PEX_MPIHARNESS_CPUAFFINITY_H
+#define LSST_PEX_MPIHARNESS_CPUAFFINITY_H
+
+#include <string>
+#include <vector>
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/**
+  * \brief   CpuAffinity places a Slice on the cores and NUMA memory of its node.
+  *
+  *          The cores the process may run on are grouped by NUMA node as
+  *          listed under /sys/devices/system/node.  Given the Slice's rank
+  *          among the Slices of its node, choose() picks its cores:
+  *
+  *            compact  consecutive cores, filling one NUMA node first
+  *            scatter  Slices dealt round-robin over the NUMA nodes
+  *            numa     all the cores of one NUMA node per Slice
+  *
+  *          apply() binds the calling thread, and so the threads it starts
+  *          later, to those cores and its memory to their NUMA nodes.
+  */
+class CpuAffinity {
+public:
+    CpuAffinity();
+    explicit CpuAffinity(const std::vector<std::vector<int> >& nodeCpus);
+
+    std::vector<int> choose(const std::string& strategy, int localRank, int localSize) const;
+    std::vector<int> getNodes(const std::vector<int>& cpus) const;
+    bool apply(const std::vector<int>& cpus) const;
+
+    int getNodeCount() const {  return _nodeCpus.size();  }
+
+    static bool isStrategy(const std::string& strategy);
+    static std::vector<int> parseList(const std::string& text);
+    static std::string format(const std::vector<int>& list);
+
+private:
+    std::vector<std::vector<int> > _nodeCpus;
+    std::vector<int> _nodeIds;
+};
+
+} // namespace mpiharness
+
+} // namespace pex
+
+} // namespace lsst
+
+#endif // LSST_PEX_MPIHARNESS_CPUAFFINITY_H
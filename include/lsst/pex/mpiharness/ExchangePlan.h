@@ -0,0 +1,132 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file ExchangePlan.h
+  *
+  * \ingroup harness
+  *
+  * \brief   ExchangePlan holds the persistent requests and buffers of the
+  *          interSlice exchanges of a Slice.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#ifndef LSST_PEX_MPIHARNESS_EXCHANGEPLAN_H
+#define LSST_PEX_MPIHARNESS_EXCHANGEPLAN_H
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include "mpi.h"
+
+#include <boost/shared_ptr.hpp>
+
+#include "lsst/pex/mpiharness/Payload.h"
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/**
+  * \brief   ExchangePlan holds the persistent requests and buffers of the
+  *          interSlice exchanges of a Slice.
+  *
+  *          The plan is built once per topology.  Each exchange packs the
+  *          Payload to send, start()s the sends and the persistent 
+  *          receives, and wait()s for them.  The receives are posted for 
+  *          the whole capacity, which starts at INITIAL_CAPACITY bytes, but
+  *          each send carries only the Payload, so a small Payload costs 
+  *          only its own bytes on the wire.  The receiver reads the length
+  *          from the Payload Header.  A Payload larger than the capacity is
+  *          sent as the capacity, then the rest with a second message, 
+  *          after which both sides double the capacity until it fits and 
+  *          the receive is rebuilt.  The plan itself stops allocating once
+  *          it has seen the largest message; serializing the PropertySets
+  *          still allocates.  One exchange may be in flight at a time.
+  */
+class ExchangePlan {
+public:
+    typedef boost::shared_ptr<ExchangePlan> Ptr;
+
+    static const int INITIAL_CAPACITY = 65536;
+
+    ExchangePlan(MPI_Comm comm, const std::list<int>& sendNeighbors,
+                 const std::list<int>& recvNeighbors);
+
+    ~ExchangePlan();
+
+    void start();
+    bool test();
+    void wait();
+
+    MPI_Comm getCommunicator() const {  return _comm;  }
+    Payload& getSendPayload() {  return _sendPayload;  }
+    Payload::Buffer& getArchiveBuffer() {  return _archiveBuffer;  }
+
+    int getRecvCount() const {  return _recvNeighbors.size();  }
+    int getSendCount() const {  return _sendNeighbors.size();  }
+    int getRecvNeighbor(int i) const {  return _recvNeighbors[i];  }
+    const std::string& getRecvKey(int i) const {  return _recvKeys[i];  }
+    const Payload& getReceived(int i) const {  return _received[i];  }
+    int getReceivedBytes(int i) const {  return _recvBytes[i];  }
+    int getSentBytes() const {  return _sentBytes;  }
+    int getRebuildCount() const {  return _rebuilds;  }
+
+private:
+    static int grow(int capacity, int wireSize);
+    void initRecv(int i);
+    void freeRequests(std::vector<MPI_Request>& requests);
+
+    MPI_Comm _comm;
+    std::vector<int> _sendNeighbors;
+    std::vector<int> _recvNeighbors;
+    std::vector<std::string> _recvKeys;
+
+    Payload _sendPayload;
+    int _sendCapacity;
+    int _sentBytes;
+    bool _overflow;
+    std::vector<MPI_Request> _sendRequests;
+    std::vector<MPI_Request> _overflowRequests;
+
+    std::vector<Payload> _received;
+    std::vector<int> _recvCapacity;
+    std::vector<int> _recvBytes;
+    std::vector<MPI_Request> _recvRequests;
+    std::vector<MPI_Status> _recvStatuses;
+
+    Payload::Buffer _archiveBuffer;
+    bool _active;
+    bool _recvComplete;
+    int _rebuilds;
+};
+
+} // namespace mpiharness
+
+} // namespace pex
+
+} // namespace lsst
+
+#endif // LSST_PEX_MPIHARNESS_EXCHANGEPLAN_H
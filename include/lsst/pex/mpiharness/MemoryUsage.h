@@ -0,0 +1,66 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file MemoryUsage.h
+  *
+  * \ingroup harness
+  *
+  * \brief   MemoryUsage samples the memory used by a Slice and by its node.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#ifndef LSST_PEX_MPIHARNESS_MEMORYUSAGE_H
+#define LSST_PEX_MPIHARNESS_MEMORYUSAGE_H
+
+#include "lsst/pex/mpiharness/Control.h"
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/**
+  * \brief   MemoryUsage samples the memory used by a Slice and by its node.
+  *
+  *          The sizes of the process come from /proc/self/status (VmRSS and
+  *          VmHWM), those of the node from /proc/meminfo.  Where a value is
+  *          not available it is reported as 0.  VmHWM is the peak over the
+  *          life of the process unless resetPeakRss() restarts it.
+  */
+class MemoryUsage {
+public:
+    static double getRss();
+    static double getPeakRss();
+    static bool resetPeakRss();
+    static double getNodeUsed();
+    static void sample(ReportLoc* report, double rssBegin, int rank);
+};
+
+} // namespace mpiharness
+
+} // namespace pex
+
+} // namespace lsst
+
+#endif // LSST_PEX_MPIHARNESS_MEMORYUSAGE_H
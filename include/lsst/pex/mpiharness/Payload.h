@@ -0,0 +1,142 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file Payload.h
+  *
+  * \ingroup harness
+  *
+  * \brief   Payload carries a serialized PropertySet between Slices,
+  *          compressed if it is large enough.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#ifndef LSST_PEX_MPIHARNESS_PAYLOAD_H
+#define LSST_PEX_MPIHARNESS_PAYLOAD_H
+
+#include <string>
+
+#include <boost/mpi.hpp>
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/**
+  * \brief   Payload carries a serialized PropertySet between Slices,
+  *          compressed if it is large enough.
+  *
+  *          pack() takes the packed archive of the PropertySet and, if it
+  *          holds at least the threshold number of bytes, deflates it at
+  *          the fastest zlib level; a payload that does not shrink is sent
+  *          as it is.  The Payload is sent as it is laid out in memory: a
+  *          Header giving the codec, the size of the archive before 
+  *          compression and the size of the data, followed by the data, so
+  *          that unpack() can restore it.  The buffer is allocated through 
+  *          MPI and only ever grows, so a Payload reused for every exchange
+  *          stops allocating once it has seen the largest message.
+  */
+class Payload {
+public:
+    typedef boost::mpi::packed_oarchive::buffer_type Buffer;
+
+    enum Codec {
+        CODEC_NONE = 0,
+        CODEC_ZLIB
+    };
+
+    /** The front of every Payload sent.
+     */
+    struct Header {
+        int codec;
+        int rawSize;
+        int size;       //!< the bytes of data following the Header
+    };
+
+    Payload();
+
+    void pack(const boost::mpi::packed_oarchive& archive, int threshold);
+    void unpack(boost::mpi::packed_iarchive& archive) const;
+
+    int getCodec() const {  return header().codec;  }
+    int getRawSize() const {  return header().rawSize;  }
+    int getSize() const {  return header().size;  }
+    int getWireSize() const {  return sizeof(Header) + header().size;  }
+
+    char* getBuffer() {  return &_buffer[0];  }
+    int getCapacity() const {  return _buffer.size();  }
+    void reserve(int capacity);
+
+private:
+    const Header& header() const {  return *reinterpret_cast<const Header*>(&_buffer[0]);  }
+    Header& header() {  return *reinterpret_cast<Header*>(&_buffer[0]);  }
+
+    Buffer _buffer;
+};
+
+/**
+  * \brief   PayloadStats counts the Payloads a process has packed and
+  *          unpacked, and the time spent compressing them.
+  *
+  *          The counters are kept by the thread that starts and waits for
+  *          the exchanges.
+  */
+class PayloadStats {
+public:
+    PayloadStats();
+
+    void recordPack(int rawSize, int size, bool compressed, double seconds);
+    void recordUnpack(double seconds);
+    void recordSend(long long bytes);
+    void reset();
+
+    long long getMessages() const {  return _messages;  }
+    long long getCompressedMessages() const {  return _compressed;  }
+    long long getRawBytes() const {  return _rawBytes;  }
+    long long getWireBytes() const {  return _wireBytes;  }
+    long long getSentBytes() const {  return _sentBytes;  }
+    double getRatio() const;
+    double getCompressTime() const {  return _compressTime;  }
+    double getDecompressTime() const {  return _decompressTime;  }
+    std::string toString() const;
+
+    static PayloadStats& getInstance();
+
+private:
+    long long _messages;
+    long long _compressed;
+    long long _rawBytes;
+    long long _wireBytes;
+    long long _sentBytes;
+    double _compressTime;
+    double _decompressTime;
+};
+
+} // namespace mpiharness
+
+} // namespace pex
+
+} // namespace lsst
+
+#endif // LSST_PEX_MPIHARNESS_PAYLOAD_H
@@ -36,6 +36,9 @@
 
 #include "mpi.h"
 
+#include <list>
+#include <map>
+#include <set>
 #include <string>
 #include <unistd.h>
 #include <vector>
@@ -60,7 +63,10 @@
 #include "lsst/ctrl/events/EventLog.h"
 #include "lsst/pex/harness/LogUtils.h"
 #include "lsst/pex/exceptions.h"
+#include "lsst/pex/mpiharness/Control.h"
+#include <boost/mpi.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 using namespace lsst::daf::base;
 using namespace lsst::pex::harness;
@@ -83,6 +89,32 @@ namespace mpiharness {
   *          between the main thread and the workers by means of MPI communciations.
   *          Pipeline loops over the collection of Stages for processing on Image.
   *          The Pipeline is configured by reading a Policy file.
+  *
+  *          Several Pipeline ranks may be started by one mpiexec to share 
+  *          the serial work of the Stages.  They run the same loop; rank 0 
+  *          of the Pipeline, the root, alone commands the Slices, and the 
+  *          others take part only in the collective steps of the control 
+  *          tree.
+  *
+  *          With memory accounting on, the Slices report their memory use
+  *          at the end of each Stage, and the Pipeline can hold back a 
+  *          visit while the memory of a node is nearly used up.
+  *
+  *          A Stage may be run as startProcess() and then waitProcess() 
+  *          with a timeout, called until the Slices are done, to give the
+  *          caller control back while the Slices process.
+  *
+  *          The Slices are reconfigured between visits, without being
+  *          started again, with the changes posted by postReconfiguration().
+  *
+  *          With the visit queue on, the coming visits are queued with
+  *          queueVisit().  The most urgent one goes next, by the "priority"
+  *          and "deadline" of its descriptor.  As the last Stage of a visit
+  *          starts, each Slice is sent its work unit for the next visit, 
+  *          so that it can read its inputs ahead of time.
+  *
+  *          getVisitLatency() gives, Stage by Stage, how long the current
+  *          visit has taken since it was queued.
   */
 
 class Pipeline {
@@ -95,13 +127,47 @@ public:
 
     void startSlices();  
     void invokeProcess(int iStage);
+    void startProcess(int iStage);
+    bool waitProcess(double timeout);
     void invokeShutdown();
     void invokeContinue();
     void invokeSyncSlices(); 
 
     void shutdown();
+    void dumpTrace(const std::string& filename);
+
+    PropertySet::Ptr gatherShards(PropertySet::Ptr ps);
+    bool agreeOnShutdown(bool stop);
+    void postControl(const std::string& message);
+    bool isDraining();
+    void postReconfiguration(PropertySet::Ptr delta);
+    PropertySet::Ptr takeReconfiguration();
+    void queueVisit(PropertySet::Ptr visit);
+    PropertySet::Ptr getVisit();
+    PropertySet::Ptr getVisitLatency();
+    PropertySet::Ptr getMemoryUsage(int iStage);
 
     int getUniverseSize();
+    int getPipelineRank() {  return pipelineRank;  }
+    int getPipelineSize() {  return pipelineSize;  }
+    bool isRoot() {  return pipelineRank == 0;  }
+
+    void setSliceCount(int count);
+    int getSliceCount();
+    void setSchedulerWeight(int weight);
+    void setSliceThreads(int nThreads);
+    void setSliceThreadLevel(const std::string& level);
+    void setControlGroupSize(int groupSize);
+    void setSliceAffinity(const std::string& strategy);
+    void setSpeculativeStage(int iStage);
+    void setSpeculationThreshold(double threshold);
+    void setSpeculationFactor(double factor);
+    void setVisitHandshake(bool handshake);
+    void setMemoryAccounting(bool accounting);
+    void setMemoryThreshold(double threshold);
+    void setMemoryWaitLimit(double seconds);
+    void setVisitQueue(bool queue);
+    void setStageCount(int count);
 
     void setRunId(char* runId);
     char* getRunId();
@@ -119,12 +185,47 @@ private:
     void configurePipeline();  
     void initializeQueues();  
     void initializeStages();  
+    void registerTenant();
+    void acquireSlicePool();
+    void releaseSlicePool();
+    void sendCommand(void* buffer, int count, MPI_Datatype datatype);
+    void controlBarrier();
+    void startReports(bool fromSlices);
+    bool receiveReports(double timeout);
+    void notifyPipelineRanks();
+    void sendControl();
+    void sendReconfiguration();
+    void disconnect();
+    void trackWorkUnits(int iStage);
+    int findStraggler(const std::vector<int>& copies, const std::vector<bool>& done, 
+                      const std::vector<double>& durations, double elapsed);
+    void sendSpeculation(int slice, int unit, int op);
+    void waitForMemory();
+    void recordMemory(int iStage);
+    void beginVisitLatency(double queuedAt, int priority, double deadline);
+    void recordLatency(int iStage);
+    void startVisit();
+    void sendLookahead();
+    void sendVisit(int visit, PropertySet::Ptr descriptor);
+    void completeVisitSends(bool wait);
+
+    struct QueuedVisit {
+        PropertySet::Ptr descriptor;
+        int priority;
+        double deadline;
+        double queuedAt;
+    };
+
+    static bool isMoreUrgent(const QueuedVisit& visit, const QueuedVisit& other);
 
     int _pid;
     char* _runId;
     char* _policyName;
 
     MPI_Comm sliceIntercomm;
+    MPI_Comm pipelineComm;
+    MPI_Comm controlIntercomm;
+    MPI_Comm harnessComm;
 
     int nStages;
     int nSlices;
@@ -132,7 +233,50 @@ private:
     int mpiError;
     int rank;
     int size;
+    int pipelineRank;
+    int pipelineSize;
     int universeSize;
+    int schedulerRank;
+    int schedulerWeight;
+    int nTenants;
+    int sliceThreads;
+    std::string sliceThreadLevel;
+    int controlGroupSize;
+    std::string sliceAffinity;
+    std::set<int> speculativeStages;
+    double speculationThreshold;
+    double speculationFactor;
+    int speculationSequence;
+    int pendingReports;
+    int nLeaders;
+    int pendingDone;
+    int processStage;
+    bool processSpeculative;
+    ReportLoc slicesReport[REPORT_FIELDS];
+    bool visitHandshake;
+    bool slicesPaused;
+    bool draining;
+    std::list<std::string> pendingControl;
+    boost::mutex controlMutex;
+    PropertySet::Ptr pendingReconfiguration;
+    PropertySet::Ptr currentReconfiguration;
+    bool memoryAccounting;
+    double memoryThreshold;
+    double memoryWaitLimit;
+    std::map<int, PropertySet::Ptr> stageMemory;
+    bool visitQueueOn;
+    int visitCount;
+    bool lookaheadSent;
+    std::list<QueuedVisit> visitQueue;
+    PropertySet::Ptr currentVisit;
+    int visitPriority;
+    double visitDeadline;
+    double visitQueuedAt;
+    double stageDispatchedAt;
+    PropertySet::Ptr visitLatency;
+    std::vector<MPI_Request> visitRequests;
+    std::vector<boost::shared_ptr<boost::mpi::packed_oarchive> > visitArchives;
+    boost::mutex visitMutex;
 
     std::string _pipename;
 
@@ -0,0 +1,117 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file Prefetcher.h
+  *
+  * \ingroup harness
+  *
+  * \brief   Prefetcher reads the input files of upcoming visits of a Slice
+  *          into memory on a background thread.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#ifndef LSST_PEX_MPIHARNESS_PREFETCHER_H
+#define LSST_PEX_MPIHARNESS_PREFETCHER_H
+
+#include <deque>
+#include <list>
+#include <map>
+#include <string>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "lsst/daf/base/PropertySet.h"
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/**
+  * \brief   Prefetcher reads the input files of upcoming visits of a Slice
+  *          into memory on a background thread.
+  *
+  *          The Pipeline sends each Slice the descriptor of its work unit
+  *          for a visit ahead of time; submit() queues it and the thread
+  *          maps each file named by the "files" entry of the descriptor,
+  *          with its pages read in, so that the Stages of that visit find
+  *          their inputs in the page cache.  The mapped files take at most
+  *          the capacity in bytes; the thread waits for room, which is made
+  *          when beginVisit() releases the files of earlier visits.  A file
+  *          larger than the whole capacity is not staged.  The files are
+  *          opened by the Stages as usual.
+  */
+class Prefetcher {
+public:
+    typedef boost::shared_ptr<Prefetcher> Ptr;
+
+    explicit Prefetcher(long long capacity);
+
+    ~Prefetcher();
+
+    void submit(int visit, lsst::daf::base::PropertySet::Ptr unit);
+    bool hasUnit(int visit);
+    lsst::daf::base::PropertySet::Ptr beginVisit(int visit);
+    void stop();
+
+    bool isStaged(const std::string& path);
+    long long getStagedBytes();
+    long long getCapacity() const {  return _capacity;  }
+
+private:
+    struct StagedFile {
+        std::string path;
+        int visit;
+        void* address;
+        size_t size;
+    };
+
+    void run();
+    bool stage(int visit, const std::string& path);
+    void release(StagedFile& file);
+
+    long long _capacity;
+    long long _used;
+    int _currentVisit;
+    bool _stopping;
+
+    std::map<int, lsst::daf::base::PropertySet::Ptr> _units;
+    std::deque<int> _queue;
+    std::list<StagedFile> _staged;
+
+    boost::mutex _mutex;
+    boost::condition_variable _changed;
+    boost::thread _thread;
+};
+
+} // namespace mpiharness
+
+} // namespace pex
+
+} // namespace lsst
+
+#endif // LSST_PEX_MPIHARNESS_PREFETCHER_H
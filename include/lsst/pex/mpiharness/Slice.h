@@ -38,6 +38,8 @@
 #include <string>
 #include <unistd.h>
 #include <list>
+#include <map>
+#include <set>
 #include <vector>
 #include <fstream>
 #include <iostream>
@@ -60,6 +62,14 @@
 #include "lsst/ctrl/events/EventLog.h"
 #include "lsst/pex/harness/LogUtils.h"
 #include "lsst/pex/exceptions.h"
+#include "lsst/pex/mpiharness/Control.h"
+#include "lsst/pex/mpiharness/ExchangePlan.h"
+#include "lsst/pex/mpiharness/MemoryUsage.h"
+#include "lsst/pex/mpiharness/Prefetcher.h"
+#include "lsst/pex/mpiharness/ThreadPool.h"
+#include "lsst/pex/mpiharness/SyncHandle.h"
+#include "lsst/pex/mpiharness/TraceBuffer.h"
+#include "lsst/pex/mpiharness/VisitFile.h"
 
 #include <boost/mpi.hpp>
 #include <boost/mpi/allocator.hpp>
@@ -68,6 +78,7 @@
 #include <boost/serialization/base_object.hpp>
 #include <boost/serialization/shared_ptr.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 
 #include "mpi.h"
 
@@ -103,16 +114,40 @@ public:
     void invokeBcast(int iStage);
     void invokeBarrier(int iStage);
     void invokeShutdownTest();
+    bool isSpeculative();
+    void reportWorkUnit(int unit, bool succeeded=true);
+    int nextWorkUnit();
+    bool isCancelled(int unit);
     void shutdown();
+    void dumpTrace(const std::string& filename);
+    void setTraceFile(const std::string& filename);
+    void setCompressionThreshold(int threshold);
+    void setIncrementalSync(bool incremental);
+    void setMemoryAccounting(bool accounting);
+    void setVisitHandshake(bool handshake);
+    bool isDraining();
+    int getLogThreshold();
+    void setPrefetch(long long capacity);
+    PropertySet::Ptr getWorkUnit();
+    Prefetcher::Ptr getPrefetcher();
+    PropertySet::Ptr takeReconfiguration();
     void setRank(int rank);
     int getRank();
     int getUniverseSize();
     void setTopology(Policy::Ptr policy); 
     void setRunId(char* runId);
     char* getRunId();
+    void setThreadLevel(const std::string& level);
+    std::string getThreadLevel();
+    void setThreadCount(int nThreads);
+    void setControlGroupSize(int groupSize);
+    void setAffinity(const std::string& strategy);
+    void setSharedPool(bool shared);
+    ThreadPool::Ptr getThreadPool();
     void calculateNeighbors();
     std::vector<int> getRecvNeighborList();
     PropertySet::Ptr syncSlices(PropertySet::Ptr dpt);
+    SyncHandle::Ptr startSyncSlices(PropertySet::Ptr dpt);
 
     void setPipelineName(const std::string& name) {
         _pipename = name;
@@ -123,13 +158,83 @@ public:
 private:
     void initializeMPI();
     void configureSlice();
+    void initializeControlTree();
+    int getHostColor();
+    void bindToCores();
+    void receiveCommand(void* buffer, int count, MPI_Datatype datatype);
+    void awaitWake(int source, MPI_Comm comm);
+    void controlBarrier();
+    void reportMemory(double rssBegin);
+    void sendReport(ReportLoc* report);
+    void receiveVisitCommand(char* command);
+    void postControlReceive();
+    void testControl(bool hold);
+    void receivePrefetch(bool wait);
+    void receiveReconfiguration();
+    void disconnect();
+    void receiveSpeculation();
+    const SyncUpdate& diffSync(PropertySet::Ptr ps);
+
+    /** A leaf of the shared PropertySet as serialized at the last exchange */
+    struct SentLeaf {
+        SentLeaf() : generation(0) { }
+        Payload::Buffer bytes;
+        unsigned int generation;    //!< the last diffSync() that saw the leaf
+    };
 
     int _pid;
     int _rank;
     Policy::Ptr _topologyPolicy; 
     char* _runId;
+    int _threadLevel;
+    int _nThreads;
+    ThreadPool::Ptr _threadPool;
+    int _controlGroupSize;
+    std::string _affinity;
+    bool _sharedPool;
+    int _compressionThreshold;
+    bool _incrementalSync;
+    bool _syncPrimed;
+    std::map<std::string, SentLeaf> _lastSent;
+    unsigned int _diffGeneration;
+    std::map<int, PropertySet::Ptr> _neighborCache;
+    SyncUpdate _syncUpdate;
+    PropertySet::Ptr _diffEntry;
+    std::vector<std::string> _diffChanged;
+    Payload::Buffer _diffBuffer;
+    std::vector<SyncHandle::Ptr> _syncHandles;
+    unsigned int _syncCount;
+    SyncHandle::Ptr _lastSync;
+    ExchangePlan::Ptr _exchangePlan;
+    Payload::Buffer _archiveBuffer;
+    bool _memoryAccounting;
+    double _rssBegin;
+    bool _peakReset;
+    bool _visitHandshake;
+    MPI_Request _controlRequest;
+    char _controlMessage[CONTROL_MESSAGE_SIZE];
+    bool _paused;
+    bool _draining;
+    int _visit;
+    Prefetcher::Ptr _prefetcher;
+    PropertySet::Ptr _workUnit;
+    int _workUnitVisit;
+    PropertySet::Ptr _reconfiguration;
+    std::string _traceFile;
+    int _stage;
+    double _stageBegin;
+    double _commandWait;
+    bool _speculative;
+    int _speculationSequence;
+    bool _speculationEnded;
+    std::list<int> _pendingUnits;
+    std::set<int> _cancelledUnits;
 
     MPI_Comm sliceIntercomm;
+    MPI_Comm nodeComm;
+    MPI_Comm controlIntercomm;
+    MPI_Comm harnessComm;
+    MPI_Comm outputComm;
     MPI_Comm topologyIntracomm;
     boost::mpi::communicator world;
 
@@ -0,0 +1,147 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file SliceScheduler.h
+  *
+  * \ingroup harness
+  *
+  * \brief   SliceScheduler arbitrates a shared pool of Slice cores among
+  *          several Pipelines running under a single mpiexec.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#ifndef LSST_PEX_MPIHARNESS_SLICESCHEDULER_H
+#define LSST_PEX_MPIHARNESS_SLICESCHEDULER_H
+
+#include "mpi.h"
+
+#include <string>
+#include <vector>
+
+#include "lsst/pex/logging/Log.h"
+#include "lsst/pex/harness/LogUtils.h"
+
+using namespace lsst::pex::harness;
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/** Message tag used for all Pipeline <-> SliceScheduler traffic on MPI_COMM_WORLD.
+ */
+const int SCHEDULER_TAG = 7301;
+
+/** Requests a Pipeline (tenant) may send to the SliceScheduler.
+ */
+enum SchedulerOp {
+    SCHEDULER_REGISTER = 1,   //!< announce the slice count and fair-share weight
+    SCHEDULER_ACQUIRE  = 2,   //!< block until the pool can run one parallel Stage of a visit of the given priority
+    SCHEDULER_RELEASE  = 3,   //!< the parallel Stage has completed
+    SCHEDULER_DONE     = 4    //!< the Pipeline is shutting down
+};
+
+/**
+  * \brief   SliceScheduler arbitrates a shared pool of Slice cores among
+  *          several Pipelines.
+  *
+  *          Several Pipelines may be launched by a single mpiexec (MPMD),
+  *          each spawning its own Slices and keeping its own Clipboards.
+  *          The Slice cores are oversubscribed, so a Pipeline must acquire its
+  *          share of the pool before it broadcasts a Stage to its Slices and
+  *          release it after the closing barrier.  Cores left idle while one
+  *          Pipeline runs serial pre/postprocess thereby go to another Pipeline.
+  *
+  *          Grants are weighted-fair: each tenant accumulates virtual time
+  *          (core-seconds divided by its weight) and the waiting tenant with
+  *          the least virtual time is served first.  A tenant that does not fit
+  *          into the free cores is not bypassed, so wide Pipelines do not starve.
+  *          A Pipeline working on a visit of higher priority is served before
+  *          the others, and the reserve, a part of the pool, is only granted 
+  *          for visits of priority above 0.
+  */
+class SliceScheduler {
+public:
+    SliceScheduler(); // constructor
+
+    ~SliceScheduler(); // destructor
+
+    void initialize();
+    void run();
+    void shutdown();
+
+    void setCapacity(int capacity);
+    int getCapacity();
+    void setReserve(int reserve);
+    int getReserve();
+
+    static int locate(bool isScheduler, MPI_Comm* localComm,
+                      int* schedulerRank, int* nTenants);
+
+private:
+    struct Tenant {
+        int rank;
+        int nSlices;
+        int weight;
+        int priority;
+        bool waiting;
+        bool running;
+        bool done;
+        double virtualTime;
+        double grantTime;
+    };
+
+    void initializeMPI();
+    Tenant& findTenant(int rank);
+    void handleRegister(int rank, int nSlices, int weight);
+    void handleAcquire(int rank, int priority);
+    void handleRelease(int rank);
+    void handleDone(int rank);
+    void dispatch();
+    double minimumVirtualTime();
+
+    std::vector<Tenant> _tenants;
+
+    MPI_Comm localComm;
+
+    int mpiError;
+    int rank;
+    int size;
+    int universeSize;
+    int capacity;
+    int reserve;
+    int freeSlices;
+    int nTenants;
+    int nDone;
+
+    LogUtils _logutils;
+};
+
+} // namespace mpiharness
+
+} // namespace pex
+
+} // namespace lsst
+
+#endif // LSST_PEX_MPIHARNESS_SLICESCHEDULER_H
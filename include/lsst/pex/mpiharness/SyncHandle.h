@@ -0,0 +1,142 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file SyncHandle.h
+  *
+  * \ingroup harness
+  *
+  * \brief   SyncHandle tracks an interSlice exchange started by
+  *          Slice::startSyncSlices().
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#ifndef LSST_PEX_MPIHARNESS_SYNCHANDLE_H
+#define LSST_PEX_MPIHARNESS_SYNCHANDLE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <boost/mpi.hpp>
+#include <boost/serialization/shared_ptr.hpp>
+#include <boost/serialization/string.hpp>
+#include <boost/serialization/vector.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "lsst/daf/base/PropertySet.h"
+#include "lsst/pex/mpiharness/ExchangePlan.h"
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+class Slice;
+
+/** The message of an interSlice exchange: the whole PropertySet a Slice 
+ * shares or, in incremental mode, only the parameters added or changed since 
+ * its previous exchange and the names of those removed.
+ */
+struct SyncUpdate {
+    SyncUpdate() : full(true) { }
+
+    bool full;
+    std::vector<std::string> removed;
+    lsst::daf::base::PropertySet::Ptr values;
+
+    template<class Archive>
+    void serialize(Archive& ar, const unsigned int version) {
+        ar & full;
+        ar & removed;
+        ar & values;
+    }
+};
+
+/**
+  * \brief   SyncHandle tracks an interSlice exchange started by
+  *          Slice::startSyncSlices().
+  *
+  *          The sends and receives to the neighbor Slices are in flight while
+  *          the Stage computes the interior of its data.  Calling test() from
+  *          time to time lets the MPI library progress the transfers; if the
+  *          Slice runs at the "multiple" thread level a background thread does
+  *          this instead.  wait() blocks only until the neighbor data is in and
+  *          returns it keyed by "neighbor-<rank>", as syncSlices() does.  The
+  *          data travels as Payloads over the ExchangePlan of the Slice and
+  *          is decompressed in wait().  In incremental mode each update 
+  *          patches the Slice's copy of what the neighbor sent before, and
+  *          wait() hands out that copy itself: it is read-only, and holds
+  *          until the next exchange.
+  *
+  *          The Slice reuses its SyncHandles from one Stage to the next,
+  *          with their result PropertySet and progress thread, so the 
+  *          result of wait() holds until the handle is started again.
+  */
+class SyncHandle {
+public:
+    typedef boost::shared_ptr<SyncHandle> Ptr;
+
+    ~SyncHandle();
+
+    bool test();
+    lsst::daf::base::PropertySet::Ptr wait();
+
+private:
+    friend class Slice;
+
+    SyncHandle(int rank, ExchangePlan::Ptr plan);
+
+    void begin(std::map<int, lsst::daf::base::PropertySet::Ptr>* neighborCache, 
+               double interval);
+    void progressLoop(double interval);
+    bool progress();
+    lsst::daf::base::PropertySet::Ptr applyUpdate(int neighbor, const SyncUpdate& update);
+
+    ExchangePlan::Ptr _plan;
+    std::map<int, lsst::daf::base::PropertySet::Ptr>* _neighborCache;
+    int _rank;
+    bool _exchanging;
+    bool _polling;
+    bool _stopping;
+
+    SyncUpdate _update;
+    lsst::daf::base::PropertySet::Ptr _result;
+
+    boost::mutex _mutex;
+    boost::condition_variable _wake;
+    boost::scoped_ptr<boost::thread> _progressThread;
+};
+
+} // namespace mpiharness
+
+} // namespace pex
+
+} // namespace lsst
+
+#endif // LSST_PEX_MPIHARNESS_SYNCHANDLE_H
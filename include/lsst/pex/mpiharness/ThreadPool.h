@@ -0,0 +1,133 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file ThreadPool.h
+  *
+  * \ingroup harness
+  *
+  * \brief   ThreadPool runs Tasks on worker threads within a single Slice.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#ifndef LSST_PEX_MPIHARNESS_THREADPOOL_H
+#define LSST_PEX_MPIHARNESS_THREADPOOL_H
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/tss.hpp>
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/**
+  * \brief   Task is a unit of work executed by a ThreadPool.
+  *
+  *          Stages subclass Task (in C++ or, through SWIG directors, in Python)
+  *          and implement run(), e.g. to process one amplifier of a CCD.  A
+  *          Python Task must be kept referenced until ThreadPool::wait() returns.
+  */
+class Task {
+public:
+    typedef boost::shared_ptr<Task> Ptr;
+
+    virtual ~Task() { }
+
+    virtual void run() = 0;
+};
+
+/**
+  * \brief   ThreadPool runs Tasks on worker threads within a single Slice.
+  *
+  *          Each thread owns a deque of Tasks.  A thread takes the newest Task
+  *          from its own deque and, when that is empty, steals the oldest Task
+  *          from another thread.  Tasks submitted from a worker thread of the
+  *          pool go to that worker's deque; all others, including those from
+  *          the workers of another pool, are dealt round-robin.  The thread
+  *          calling wait() works through Tasks as well, so a pool of n threads
+  *          starts n-1 workers and a pool of one thread runs everything inline.
+  *
+  *          Worker threads must not call MPI unless the Slice was initialized
+  *          with the "multiple" thread level.
+  */
+class ThreadPool {
+public:
+    typedef boost::shared_ptr<ThreadPool> Ptr;
+
+    explicit ThreadPool(int nThreads=1);
+
+    ~ThreadPool();
+
+    void submit(Task::Ptr task);
+    void wait();
+    void stop();
+
+    int getThreadCount() const {  return _nThreads;  }
+
+    static void setDefault(Ptr pool);
+    static Ptr getDefault();
+
+private:
+    struct WorkQueue {
+        boost::mutex mutex;
+        std::deque<Task::Ptr> tasks;
+    };
+
+    bool take(int index, Task::Ptr& task);
+    void execute(Task::Ptr task);
+    void workerLoop(int index);
+
+    int _nThreads;
+    int _nextQueue;
+    int _queued;
+    int _pending;
+    bool _stopping;
+    std::string _failure;
+
+    std::vector<WorkQueue*> _queues;
+    boost::thread_group _threads;
+    boost::mutex _mutex;
+    boost::condition_variable _workReady;
+    boost::condition_variable _allDone;
+
+    /* The pool and deque index of a worker thread */
+    static boost::thread_specific_ptr<std::pair<ThreadPool*, int> > _worker;
+    static Ptr _default;
+};
+
+} // namespace mpiharness
+
+} // namespace pex
+
+} // namespace lsst
+
+#endif // LSST_PEX_MPIHARNESS_THREADPOOL_H
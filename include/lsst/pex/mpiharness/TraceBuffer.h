@@ -0,0 +1,124 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file TraceBuffer.h
+  *
+  * \ingroup harness
+  *
+  * \brief   TraceBuffer records harness events in a binary ring buffer.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#ifndef LSST_PEX_MPIHARNESS_TRACEBUFFER_H
+#define LSST_PEX_MPIHARNESS_TRACEBUFFER_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/** Events recorded by the Pipeline and Slice on their MPI hot path.  A
+ * Slice records the size in bytes of the PropertySet it sends and the number
+ * of neighbors it sends to with TRACE_SYNC_POSTED; the durations and sizes
+ * are what bin/simulateHarness.py replays.  In incremental mode it records
+ * the number of changed and removed leaves with TRACE_SYNC_DIFF.
+ */
+enum TraceEvent {
+    TRACE_BCAST_BEGIN = 1,
+    TRACE_BCAST_END,
+    TRACE_BARRIER_BEGIN,
+    TRACE_BARRIER_END,
+    TRACE_SYNC_BEGIN,
+    TRACE_SYNC_POSTED,
+    TRACE_SYNC_END,
+    TRACE_PROCESS_BEGIN,
+    TRACE_PROCESS_END,
+    TRACE_SPECULATE_RUN,
+    TRACE_SPECULATE_CANCEL,
+    TRACE_VISIT_BEGIN,
+    TRACE_PREPROCESS_BEGIN,
+    TRACE_PREPROCESS_END,
+    TRACE_POSTPROCESS_BEGIN,
+    TRACE_POSTPROCESS_END,
+    TRACE_UNIT_DONE,
+    TRACE_SYNC_DIFF,
+    TRACE_EVENT_MAX
+};
+
+/** A single fixed-size trace record.
+ */
+struct TraceRecord {
+    double time;            //!< MPI_Wtime() when the event was recorded
+    unsigned int sequence;  //!< 1 + the record's position; 0 while being written
+    int event;              //!< a TraceEvent
+    int rank;
+    int stage;
+    int arg1;
+    int arg2;
+};
+
+/**
+  * \brief   TraceBuffer records harness events in a binary ring buffer.
+  *
+  *          Recording an event costs one atomic increment and a handful of
+  *          stores; nothing is formatted until the buffer is dumped, e.g. when
+  *          a Stage fails or the process shuts down.  The buffer keeps the most
+  *          recent records and overwrites the oldest.  Human-facing messages
+  *          still go through LogUtils.
+  */
+class TraceBuffer {
+public:
+    explicit TraceBuffer(unsigned int capacity=65536);
+
+    void record(int event, int rank, int stage, int arg1=0, int arg2=0);
+
+    void dump(std::ostream& os, unsigned int maxRecords=0) const;
+    void dump(const std::string& filename) const;
+    std::string toString(unsigned int maxRecords=0) const;
+    void clear();
+
+    void setEnabled(bool enabled) {  _enabled = enabled;  }
+    bool isEnabled() const {  return _enabled;  }
+
+    static TraceBuffer& getInstance();
+    static const char* getEventName(int event);
+
+private:
+    std::vector<TraceRecord> _records;
+    unsigned int _mask;
+    volatile unsigned int _next;
+    bool _enabled;
+};
+
+} // namespace mpiharness
+
+} // namespace pex
+
+} // namespace lsst
+
+#endif // LSST_PEX_MPIHARNESS_TRACEBUFFER_H
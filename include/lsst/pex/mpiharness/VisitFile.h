@@ -0,0 +1,133 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file VisitFile.h
+  *
+  * \ingroup harness
+  *
+  * \brief   VisitFile writes the fixed-size records of all Slices into one
+  *          shared file with collective MPI-IO; VisitFileReader maps it.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#ifndef LSST_PEX_MPIHARNESS_VISITFILE_H
+#define LSST_PEX_MPIHARNESS_VISITFILE_H
+
+#include <string>
+#include <vector>
+
+#include <boost/shared_ptr.hpp>
+
+#include "mpi.h"
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/**
+  * \brief   VisitFile writes the fixed-size records of all Slices into one
+  *          shared file with collective MPI-IO.
+  *
+  *          Every Slice constructs the VisitFile and calls write() once, so
+  *          that a visit produces a single file instead of one per Slice.
+  *          The records of Slice i follow those of Slice i-1; the offsets
+  *          come from an exclusive scan of the record counts.  The file
+  *          starts with a header giving the number of Slices, the record
+  *          size and the index of the first record of each Slice:
+  *
+  *            char     magic[8]          "MPIHVIS1"
+  *            int32    nSlices
+  *            int32    recordSize
+  *            int64    firstRecord[nSlices+1]
+  *            records ...
+  *
+  *          in the byte order of the machine that wrote it.
+  */
+class VisitFile {
+public:
+    typedef boost::shared_ptr<VisitFile> Ptr;
+
+    VisitFile(const std::string& filename, int recordSize);
+    ~VisitFile();
+
+    void write(const std::string& records);
+    void write(const void* records, long long nRecords);
+    void close();
+
+    int getRecordSize() {  return _recordSize;  }
+    long long getRecordCount() {  return _nRecords;  }
+
+    static void setCommunicator(MPI_Comm comm);
+
+private:
+    int _recordSize;
+    long long _nRecords;
+    bool _written;
+    MPI_File _file;
+    MPI_Comm _comm;
+    std::string _filename;
+
+    static MPI_Comm _defaultComm;
+};
+
+/**
+  * \brief   VisitFileReader memory-maps a file written by VisitFile.
+  *
+  *          The records of each Slice are read straight from the mapping;
+  *          nothing is copied unless getRecords() is used.
+  */
+class VisitFileReader {
+public:
+    typedef boost::shared_ptr<VisitFileReader> Ptr;
+
+    explicit VisitFileReader(const std::string& filename);
+    ~VisitFileReader();
+
+    int getSliceCount() {  return _nSlices;  }
+    int getRecordSize() {  return _recordSize;  }
+    long long getRecordCount();
+    long long getRecordCount(int slice);
+    const char* getRecordData(int slice);
+    std::string getRecords(int slice);
+
+private:
+    void checkSlice(int slice);
+
+    std::string _filename;
+    char* _map;
+    size_t _length;
+    int _nSlices;
+    int _recordSize;
+    const long long* _firstRecord;
+    const char* _data;
+};
+
+} // namespace mpiharness
+
+} // namespace pex
+
+} // namespace lsst
+
+#endif // LSST_PEX_MPIHARNESS_VISITFILE_H
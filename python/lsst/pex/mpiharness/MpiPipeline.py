@@ -31,6 +31,7 @@ from lsst.pex.harness.harnessLib import TracingLog
 from lsst.pex.logging import Log, LogRec, cout, Prop
 from lsst.pex.harness import harnessLib as logutils
 from lsst.pex.mpiharness import mpiharnessLib as mpiutils
+from lsst.pex.mpiharness.Reconfiguration import applyReconfiguration
 
 import lsst.pex.policy as policy
 
@@ -77,7 +78,16 @@ class MpiPipeline(Pipeline):
         self._runId = runId
         self.pipelinePolicyName = pipelinePolicyName
         self.forceShutdown = 0
-        self.delayTime = 0.01
+        self.traceFile = None
+        self.memoryAccounting = False
+        self.memoryTopic = None
+        self.memoryTransmitter = None
+        self.latencyTopic = None
+        self.latencyTransmitter = None
+        self.latencyBudget = None
+        self.pollInterval = None
+        self.stopNoticed = False
+        self.visitQueue = False
 
 
     def __del__(self):
@@ -88,6 +98,121 @@ class MpiPipeline(Pipeline):
             self.log.log(self.VERB1, 'Python Pipeline being deleted')
 
 
+    def configurePipeline(self):
+        """
+        Configure the Pipeline from its policy.  The optional settings are:
+
+        nSlices               the number of Slices to spawn
+        schedulerWeight       the share of a Slice pool shared with other
+                              Pipelines; the Slices of a shared pool sleep
+                              between commands in naps of up to 100 us,
+                              which adds as much latency to each command
+        sliceThreads          the size of the ThreadPool of each Slice
+        threadLevel           the MPI thread level of the Slices
+        controlGroupSize      group the Slices of the control tree by count
+                              rather than by node
+        sliceAffinity         pin each Slice to cores of its node
+        speculativeStages     the Stages whose straggling work units are
+                              run again on idle Slices; they must poll
+                              workUnitCancelled
+        speculationThreshold  the fraction of work units done before
+                              stragglers are run again
+        speculationFactor     how many times the median time makes a
+                              straggler
+        memoryAccounting      the Slices report their memory use after
+                              every Stage, which is logged
+        memoryTopic           the topic the memory use is published on
+        memoryThreshold       hold a visit back while a node has more than
+                              this fraction of its memory in use
+        memoryWaitLimit       the longest a visit is held back, in seconds
+        pollInterval          return to Python this often, in seconds,
+                              while the Slices process, so that signals
+                              and shutdown events are noticed
+        visitQueue            take the visits from the queue filled with
+                              queueVisit(), most urgent first by priority
+                              and deadline; on by default with prefetchMB
+        prefetchMB            the Slices read the inputs of the next
+                              visit ahead, into at most this many MB;
+                              needs the visit queue
+        latencyTopic          the topic the latency of each visit since it
+                              was queued is published on
+        latencyBudget         warn about Stages that end later than this
+                              many seconds after their visit was queued
+        traceFile             the file the hot-path trace is written to at
+                              shutdown; ranks other than the root add
+                              their rank to the name
+
+        If the Slices wait for an event before the first Stage, each visit
+        starts with a handshake with them.
+        """
+        Pipeline.configurePipeline(self)
+
+        if self.executePolicy.exists('nSlices'):
+            self.cppPipeline.setSliceCount(self.executePolicy.getInt('nSlices'))
+        if self.executePolicy.exists('schedulerWeight'):
+            self.cppPipeline.setSchedulerWeight(
+                self.executePolicy.getInt('schedulerWeight'))
+        if self.executePolicy.exists('sliceThreads'):
+            self.cppPipeline.setSliceThreads(
+                self.executePolicy.getInt('sliceThreads'))
+        if self.executePolicy.exists('threadLevel'):
+            self.cppPipeline.setSliceThreadLevel(
+                self.executePolicy.getString('threadLevel'))
+        if self.executePolicy.exists('controlGroupSize'):
+            self.cppPipeline.setControlGroupSize(
+                self.executePolicy.getInt('controlGroupSize'))
+        if self.executePolicy.exists('sliceAffinity'):
+            self.cppPipeline.setSliceAffinity(
+                self.executePolicy.getString('sliceAffinity'))
+        if self.executePolicy.exists('speculativeStages'):
+            for iStage in self.executePolicy.getIntArray('speculativeStages'):
+                self.cppPipeline.setSpeculativeStage(iStage)
+        if self.executePolicy.exists('speculationThreshold'):
+            self.cppPipeline.setSpeculationThreshold(
+                self.executePolicy.getDouble('speculationThreshold'))
+        if self.executePolicy.exists('speculationFactor'):
+            self.cppPipeline.setSpeculationFactor(
+                self.executePolicy.getDouble('speculationFactor'))
+        if self.executePolicy.exists('memoryAccounting'):
+            self.memoryAccounting = \
+                self.executePolicy.getBool('memoryAccounting')
+            self.cppPipeline.setMemoryAccounting(self.memoryAccounting)
+        if self.executePolicy.exists('memoryThreshold'):
+            self.cppPipeline.setMemoryThreshold(
+                self.executePolicy.getDouble('memoryThreshold'))
+        if self.executePolicy.exists('memoryWaitLimit'):
+            self.cppPipeline.setMemoryWaitLimit(
+                self.executePolicy.getDouble('memoryWaitLimit'))
+        # Slices that wait for an event before the first Stage must hear
+        # of a shutdown before they block on it
+        stagePolicies = self.executePolicy.getPolicyArray('appStage')
+        if len(stagePolicies) > 0 and stagePolicies[0].exists('eventTopic') \
+               and stagePolicies[0].getString('eventTopic') != "None":
+            self.cppPipeline.setVisitHandshake(True)
+        prefetch = self.executePolicy.exists('prefetchMB') and \
+                   self.executePolicy.getInt('prefetchMB') > 0
+        if self.executePolicy.exists('visitQueue'):
+            self.visitQueue = self.executePolicy.getBool('visitQueue')
+            if prefetch and not self.visitQueue:
+                self.log.log(Log.WARN, "prefetchMB ignored: visitQueue is off")
+        else:
+            self.visitQueue = prefetch
+        self.cppPipeline.setVisitQueue(self.visitQueue)
+        if self.executePolicy.exists('pollInterval'):
+            self.pollInterval = self.executePolicy.getDouble('pollInterval')
+        if self.executePolicy.exists('memoryTopic'):
+            self.memoryTopic = self.executePolicy.getString('memoryTopic')
+        if self.executePolicy.exists('latencyTopic'):
+            self.latencyTopic = self.executePolicy.getString('latencyTopic')
+        if self.executePolicy.exists('latencyBudget'):
+            self.latencyBudget = self.executePolicy.getDouble('latencyBudget')
+        if self.executePolicy.exists('traceFile'):
+            self.traceFile = "%s.pipeline" % \
+                self.executePolicy.getString('traceFile')
+            if not self.cppPipeline.isRoot():
+                self.traceFile += str(self.cppPipeline.getPipelineRank())
+
+
     def startSlices(self):
         """
         Initialize the Queue by defining an initial dataset list
@@ -105,12 +230,18 @@ class MpiPipeline(Pipeline):
         looplog = TracingLog(self.log, "visit", self.TRACE)
         stagelog = TracingLog(looplog, "stage", self.TRACE-1)
         proclog = TracingLog(stagelog, "process", self.TRACE)
+        trace = mpiutils.TraceBuffer.getInstance()
 
         visitcount = 0 
 
+        # the next visit is sent ahead to the Slices as the last Stage starts
+        self.cppPipeline.setStageCount(self.nStages)
+
         while True:
 
-            time.sleep(self.delayTime)
+            # the root decides for all the Pipeline ranks
+            self.forceShutdown = int(
+                self.cppPipeline.agreeOnShutdown(self.forceShutdown == 1))
 
             if ((((self.executionMode == 1) and (visitcount == 1)) or self.forceShutdown == 1)):
                 LogRec(looplog, Log.INFO)  << "terminating pipeline and slices after one loop/visit "
@@ -129,6 +260,11 @@ class MpiPipeline(Pipeline):
                 # synchronize at the top of the Stage loop 
                 self.cppPipeline.invokeContinue()
 
+                # the Slices apply the same reconfiguration with this visit
+                delta = self.cppPipeline.takeReconfiguration()
+                if delta.nameCount() > 0:
+                    applyReconfiguration(delta, self.stageList, self.log)
+
                 self.startInitQueue()    # place an empty clipboard in the first Queue
 
                 self.errorFlagged = 0
@@ -141,26 +277,39 @@ class MpiPipeline(Pipeline):
 
                     self.handleEvents(iStage, stagelog)
 
+                    self.postShard(self.queueList[iStage-1])
+
+                    trace.record(mpiutils.TRACE_PREPROCESS_BEGIN, 0, iStage)
                     self.tryPreProcess(iStage, stage, stagelog)
+                    trace.record(mpiutils.TRACE_PREPROCESS_END, 0, iStage)
 
                     # if(self.isDataSharingOn):
                     #     self.invokeSyncSlices(iStage, stagelog)
 
                     proclog.start("process and wait")
-                    self.cppPipeline.invokeProcess(iStage)
+                    if self.pollInterval is None:
+                        self.cppPipeline.invokeProcess(iStage)
+                    else:
+                        self.cppPipeline.startProcess(iStage)
+                        while not self.cppPipeline.waitProcess(self.pollInterval):
+                            self.noticeStop(proclog)
                     proclog.done()
 
+                    if self.memoryAccounting:
+                        self.reportMemory(iStage, stagelog)
+                    self.reportLatency(iStage, stagelog)
+
+                    trace.record(mpiutils.TRACE_POSTPROCESS_BEGIN, 0, iStage)
                     self.tryPostProcess(iStage, stage, stagelog)
+                    trace.record(mpiutils.TRACE_POSTPROCESS_END, 0, iStage)
 
                     stagelog.done()
 
-                    time.sleep(self.delayTime)
                     self.checkExitByStage()
 
                 else:
                     looplog.log(self.VERB2, "Completed Stage Loop")
 
-                time.sleep(self.delayTime)
                 self.checkExitByVisit()
 
 
@@ -181,6 +330,120 @@ class MpiPipeline(Pipeline):
         self.shutdown()
 
 
+    def postShard(self, queue):
+        """
+        Tell the serial part of the Stage on the next Clipboard in the queue
+        which share of the serial work is this Pipeline rank's:
+        "pipelineRank" and "pipelineSize" give the rank and the number of
+        Pipeline ranks, "shardRange" a function that returns the range
+        (first, last+1) of n keys that belong to this rank, and
+        "gatherShards" a function that collects a PropertySet from every
+        rank on the root (rank 0), keyed by "shard-<rank>".  With the visit
+        queue on, "visit" is the descriptor of the current visit and
+        "queueVisit" a function that queues that of a coming visit
+        """
+        rank = self.cppPipeline.getPipelineRank()
+        size = self.cppPipeline.getPipelineSize()
+        clipboard = queue.getNextDataset()
+        clipboard.put("pipelineRank", rank)
+        clipboard.put("pipelineSize", size)
+        clipboard.put("shardRange",
+                      lambda n: (n * rank // size, n * (rank + 1) // size))
+        clipboard.put("gatherShards", self.cppPipeline.gatherShards)
+        if self.visitQueue:
+            clipboard.put("visit", self.cppPipeline.getVisit())
+            clipboard.put("queueVisit", self.cppPipeline.queueVisit)
+        queue.addDataset(clipboard)
+
+    def noticeStop(self, proclog):
+        """
+        Called between polls while the Slices process: log, once, that the
+        shutdown thread has received a shutdown event, which takes effect
+        at the next point its exit level allows
+        """
+        if self._stop.isSet() and not self.stopNoticed:
+            self.stopNoticed = True
+            proclog.log(Log.INFO,
+                        "Shutdown requested during the Stage at exitLevel %d"
+                        % self.exitLevel)
+
+    def reportMemory(self, iStage, stagelog):
+        """
+        Log the memory use of the Slices in the Stage just processed, with
+        its high-water marks, and publish it to the memoryTopic if one is
+        configured.  The root alone receives the reports of the Slices.
+        """
+        if not self.cppPipeline.isRoot():
+            return
+        ps = self.cppPipeline.getMemoryUsage(iStage)
+        if not ps.exists("rss"):
+            return
+        LogRec(stagelog, Log.INFO) \
+            << "memory use" \
+            << Prop("rssBegin", ps.getDouble("rssBegin")) \
+            << Prop("rss", ps.getDouble("rss")) \
+            << Prop("rssSlice", ps.getInt("rssSlice")) \
+            << Prop("peakRss", ps.getDouble("peakRss")) \
+            << Prop("peakRssSlice", ps.getInt("peakRssSlice")) \
+            << Prop("nodeUsed", ps.getDouble("nodeUsed")) \
+            << Prop("maxPeakRss", ps.getDouble("maxPeakRss")) \
+            << Prop("maxNodeUsed", ps.getDouble("maxNodeUsed")) \
+            << LogRec.endr
+        if self.memoryTopic is not None:
+            if self.memoryTransmitter is None:
+                self.memoryTransmitter = events.EventTransmitter(
+                    self.eventBrokerHost, self.memoryTopic)
+            ps.setString("runId", self._runId)
+            ps.setString("stageName", self.stageNames[iStage-1])
+            self.memoryTransmitter.publish(ps)
+
+    def reportLatency(self, iStage, stagelog):
+        """
+        Log the latency of the visit up to the end of the Stage just
+        processed, warning if it is over the latencyBudget or past the
+        deadline of the visit, and publish it to the latencyTopic if one is
+        configured.  The root alone keeps the latency.
+        """
+        if not self.cppPipeline.isRoot():
+            return
+        ps = self.cppPipeline.getVisitLatency()
+        key = "stage-%d" % iStage
+        if not ps.exists(key):
+            return
+        stage = ps.getPropertySet(key)
+        rec = LogRec(stagelog, Log.INFO)
+        rec << "visit latency" \
+            << Prop("priority", ps.getInt("priority")) \
+            << Prop("queueWait", ps.getDouble("queueWait")) \
+            << Prop("dispatched", stage.getDouble("dispatched")) \
+            << Prop("completed", stage.getDouble("completed"))
+        if stage.exists("sliceProcess"):
+            rec << Prop("sliceWait", stage.getDouble("sliceWait")) \
+                << Prop("sliceWaitSlice", stage.getInt("sliceWaitSlice")) \
+                << Prop("sliceProcess", stage.getDouble("sliceProcess")) \
+                << Prop("sliceProcessSlice", stage.getInt("sliceProcessSlice"))
+        rec << LogRec.endr
+
+        completed = stage.getDouble("completed")
+        if self.latencyBudget is not None and completed > self.latencyBudget:
+            stagelog.log(Log.WARN,
+                         "Stage %d ended %.1f s after the visit was queued, over the budget of %.1f s"
+                         % (iStage, completed, self.latencyBudget))
+        if stage.exists("slack") and stage.getDouble("slack") < 0.0:
+            stagelog.log(Log.WARN, "Stage %d ended %.1f s past the deadline of the visit"
+                         % (iStage, -stage.getDouble("slack")))
+
+        if self.latencyTopic is not None:
+            if self.latencyTransmitter is None:
+                self.latencyTransmitter = events.EventTransmitter(
+                    self.eventBrokerHost, self.latencyTopic)
+            stage.setString("runId", self._runId)
+            stage.setString("stageName", self.stageNames[iStage-1])
+            stage.setInt("stage", iStage)
+            stage.setInt("priority", ps.getInt("priority"))
+            stage.setDouble("queueWait", ps.getDouble("queueWait"))
+            self.latencyTransmitter.publish(stage)
+
     def checkExitBySyncPoint(self): 
         log = Log(self.log, "checkExitBySyncPoint")
 
@@ -205,13 +468,65 @@ class MpiPipeline(Pipeline):
             log.log(Log.INFO, "Exit here at the end of the Visit")
             self.forceShutdown = 1
 
+        if self.cppPipeline.isDraining():
+            log.log(Log.INFO, "Pipeline is draining")
+            log.log(Log.INFO, "Exit here at the end of the Visit")
+            self.forceShutdown = 1
+
+    def queueVisit(self, visit):
+        """
+        Queue the descriptor of a coming visit, a PropertySet holding the
+        work unit of Slice i as "slice-<i>" with the input files it reads
+        listed under "files".  An optional "priority" (higher goes first)
+        and "deadline" (time.time() by which it should be done) put it
+        ahead of less urgent visits; may be called from any thread
+        """
+        self.cppPipeline.queueVisit(visit)
+
+    def pauseSlices(self):
+        """
+        Hold every Slice at the end of its current Stage until
+        resumeSlices(); may be called from any thread
+        """
+        self.cppPipeline.postControl("PAUSE")
+
+    def resumeSlices(self):
+        """
+        Let Slices held by pauseSlices() go on; may be called from any thread
+        """
+        self.cppPipeline.postControl("RESUME")
+
+    def drain(self):
+        """
+        Finish the current visit and shut down; may be called from any
+        thread
+        """
+        self.cppPipeline.postControl("DRAIN")
+
+    def setSliceLogThreshold(self, threshold):
+        """
+        Set the threshold of the logs of the Slices; may be called from any
+        thread
+        """
+        self.cppPipeline.postControl("LOGLEVEL %d" % threshold)
+
+    def reconfigure(self, delta):
+        """
+        Change the configuration of the Pipeline and the Slices at the start
+        of the next visit, without starting the Slices again.  The delta is
+        a PropertySet that may hold "logThreshold"; "stage-<i>", the policy
+        parameters to set for Stage i; and "topology", a new Slice topology
+        given by "type", "param1" and "param2"; may be called from any thread
+        """
+        self.cppPipeline.postReconfiguration(delta)
+
 
     def shutdown(self): 
         """
         Shutdown the Pipeline execution: delete the MPI environment
         Send the Exit Event if required
         """
-        if self.exitTopic == None:
+        if self.exitTopic == None or not self.cppPipeline.isRoot():
             pass
         else:
             oneEventTransmitter = events.EventTransmitter(self.eventBrokerHost, self.exitTopic)
@@ -225,6 +540,9 @@ class MpiPipeline(Pipeline):
         self.oneShutdownThread.join()
         self.log.log(self.VERB2, 'Shutdown thread ended ')
 
+        if self.traceFile is not None:
+            self.cppPipeline.dumpTrace(self.traceFile)
+
         self.log.log(self.VERB2, 'Pipeline calling MPI_Finalize ')
         self.cppPipeline.shutdown()
 
@@ -30,6 +30,7 @@ from lsst.pex.harness.harnessLib import TracingLog
 from lsst.pex.harness.Directories import Directories
 from lsst.pex.logging import Log, LogRec, Prop
 from lsst.pex.mpiharness import mpiharnessLib as mpiutils
+from lsst.pex.mpiharness.Reconfiguration import applyReconfiguration
 
 import lsst.pex.policy as policy
 import lsst.pex.exceptions as ex
@@ -65,10 +66,18 @@ class MpiSlice(Slice):
     '''Slice: Python Slice class implementation. Wraps C++ Slice'''
 
     #------------------------------------------------------------------------
-    def __init__(self, runId="TEST", pipelinePolicyName=None, name="unnamed"):
+    def __init__(self, runId="TEST", pipelinePolicyName=None, name="unnamed",
+                 threadLevel=None, nThreads=None, controlGroupSize=None,
+                 affinity=None, sharedPool=False, visitQueue=False):
         """
         Initialize the Slice: create an empty Queue List and Stage List;
-        Import the C++ Slice  and initialize the MPI environment
+        Import the C++ Slice  and initialize the MPI environment at the
+        given MPI thread level, with a ThreadPool of nThreads threads,
+        joining control tree groups of controlGroupSize Slices (by node if 0)
+        and pinned to cores by the given affinity strategy; with sharedPool
+        the Slice sleeps between commands, leaving its core to the Slices of
+        other pipelines; visitQueue tells that the Pipeline sends the work
+        units ahead, without which the Slice cannot prefetch
         """
 
         # super(MpiSlice, self).__init__()
@@ -76,9 +85,21 @@ class MpiSlice(Slice):
         # log message levels
         self.cppSlice = mpiutils.Slice(self._pipelineName)
         self.cppSlice.setRunId(runId)
+        if threadLevel is not None:
+            self.cppSlice.setThreadLevel(threadLevel)
+        if nThreads is not None:
+            self.cppSlice.setThreadCount(nThreads)
+        if controlGroupSize is not None:
+            self.cppSlice.setControlGroupSize(controlGroupSize)
+        if affinity is not None:
+            self.cppSlice.setAffinity(affinity)
+        self.cppSlice.setSharedPool(sharedPool)
         self.cppSlice.initialize()
         self._rank = self.cppSlice.getRank()
         self.universeSize = self.cppSlice.getUniverseSize()
+        self.syncHandles = []
+        self.traceFile = None
+        self.visitQueue = visitQueue
 
 
     def __del__(self):
@@ -89,6 +110,54 @@ class MpiSlice(Slice):
             self.log.log(self.VERB1, 'Python Slice being deleted')
 
 
+    def configureSlice(self):
+        """
+        Configure the Slice from its policy.  The optional settings are:
+
+        compressionThreshold  compress the PropertySets sent by syncSlices
+                              from this many bytes
+        incrementalSync       send only what changed since the previous
+                              syncSlices
+        memoryAccounting      report the memory use after every Stage;
+                              must match the Pipeline
+        prefetchMB            read the inputs of the next work unit ahead
+                              of the visit, into at most this many MB;
+                              ignored unless the Pipeline queues visits
+        traceFile             the file the hot-path trace is written to at
+                              shutdown
+
+        If the Slices wait for an event before the first Stage, each visit
+        starts with a handshake with the Pipeline.
+        """
+        Slice.configureSlice(self)
+
+        if self.executePolicy.exists('compressionThreshold'):
+            self.cppSlice.setCompressionThreshold(
+                self.executePolicy.getInt('compressionThreshold'))
+        stagePolicies = self.executePolicy.getPolicyArray('appStage')
+        if len(stagePolicies) > 0 and stagePolicies[0].exists('eventTopic') \
+               and stagePolicies[0].getString('eventTopic') != "None":
+            self.cppSlice.setVisitHandshake(True)
+        if self.executePolicy.exists('memoryAccounting'):
+            self.cppSlice.setMemoryAccounting(
+                self.executePolicy.getBool('memoryAccounting'))
+        if self.executePolicy.exists('prefetchMB'):
+            prefetchMB = self.executePolicy.getInt('prefetchMB')
+            if self.visitQueue:
+                self.cppSlice.setPrefetch(prefetchMB * 1024 * 1024)
+            elif prefetchMB > 0:
+                self.log.log(Log.WARN, "prefetchMB ignored: the Pipeline "
+                             "does not queue visits")
+        if self.executePolicy.exists('incrementalSync'):
+            self.cppSlice.setIncrementalSync(
+                self.executePolicy.getBool('incrementalSync'))
+
+        if self.executePolicy.exists('traceFile'):
+            self.traceFile = "%s.slice%d" % \
+                (self.executePolicy.getString('traceFile'), self._rank)
+            self.cppSlice.setTraceFile(self.traceFile)
+
+
     def startStagesLoop(self): 
         """
         Execute the Stage loop. The loop progressing in step with 
@@ -109,6 +178,11 @@ class MpiSlice(Slice):
             self.cppSlice.invokeShutdownTest()
             looplog.log(self.VERB3, "Tested for Shutdown")
 
+            # the Pipeline may have changed the log threshold
+            threshold = self.cppSlice.getLogThreshold()
+            if threshold != self.log.getThreshold():
+                self.log.setThreshold(threshold)
+
             self.startInitQueue()    # place an empty clipboard in the first Queue
 
             self.errorFlagged = 0
@@ -121,6 +195,8 @@ class MpiSlice(Slice):
 
                 # if(self.isDataSharingOn):
                 #    self.syncSlices(iStage, stagelog) 
+                # or, to overlap the exchange with process():
+                #    self.startSyncSlices(iStage, stagelog) 
 
                 self.tryProcess(iStage, stageObject, stagelog)
 
@@ -195,6 +271,41 @@ class MpiSlice(Slice):
 
         synclog.done()
 
+    def startSyncSlices(self, iStage, stageLog):
+        """
+        If needed, starts interSlice communication prior to Stage process
+        without waiting for it to complete.  The SyncHandle for each shared
+        key is placed on the Clipboard as "<key>-syncHandle"; the Stage calls
+        its wait() once it needs the neighbor data, which is then keyed by
+        "neighbor-<rank>".
+        """
+        synclog = stageLog.traceBlock("startSyncSlices", self.TRACE-1);
+
+        if(self.shareDataList[iStage-1]):
+            queue = self.queueList[iStage-1]
+            clipboard = queue.getNextDataset()
+            sharedKeys = clipboard.getSharedKeys()
+
+            for skey in sharedKeys:
+                synclog.log(Log.DEBUG,
+                        "Starting C++ syncSlices for keyToShare: " + skey)
+
+                handle = self.cppSlice.startSyncSlices(clipboard.get(skey))
+                clipboard.put(skey + "-syncHandle", handle, False)
+                self.syncHandles.append(handle)
+
+            queue.addDataset(clipboard)
+
+        synclog.done()
+
+    def finishSyncSlices(self):
+        """
+        Complete any interSlice communication the Stage did not wait for
+        """
+        for handle in self.syncHandles:
+            handle.wait()
+        self.syncHandles = []
+
     def tryProcess(self, iStage, stage, stagelog):
         """
         Executes the try/except construct for Stage process() call 
@@ -206,6 +317,18 @@ class MpiSlice(Slice):
         proclog.log(self.VERB3, "Getting process signal from Pipeline")
         self.cppSlice.invokeBcast(iStage)
 
+        # the Pipeline may have reconfigured the Stages for this visit
+        delta = self.cppSlice.takeReconfiguration()
+        if delta.nameCount() > 0:
+            applyReconfiguration(delta, self.stageList, self.log)
+
+        if self.cppSlice.getPrefetcher():
+            self.postWorkUnitDescriptor(self.queueList[iStage-1])
+
+        polled = None
+        if self.cppSlice.isSpeculative():
+            polled = self.postWorkUnit(self.queueList[iStage-1], self._rank)
+
         # Important try - except construct around stage process() 
         try:
             # If no error/exception has been flagged, run process()
@@ -223,6 +346,8 @@ class MpiSlice(Slice):
             trace = "".join(traceback.format_exception(
                 sys.exc_info()[0], sys.exc_info()[1], sys.exc_info()[2]))
             proclog.log(Log.FATAL, trace)
+            proclog.log(Log.FATAL, "Recent harness trace:\n" +
+                        mpiutils.TraceBuffer.getInstance().toString(64))
 
             # Flag that an exception occurred to guide the framework to skip processing
             self.errorFlagged = 1
@@ -230,10 +355,89 @@ class MpiSlice(Slice):
             self.postOutputClipboard(iStage)
 
 
-        proclog.log(self.VERB3, "Getting end of process signal from Pipeline")
-        self.cppSlice.invokeBarrier(iStage)
+        self.finishSyncSlices()
+
+        if self.cppSlice.isSpeculative():
+            # a Stage that cannot be cancelled would hold up the next
+            # Stage of the whole group of this Slice
+            if self.errorFlagged == 0 and not polled[0]:
+                proclog.log(Log.FATAL, "Stage %d is speculative but never "
+                            "called workUnitCancelled" % iStage)
+                self.errorFlagged = 1
+            self.cppSlice.reportWorkUnit(self._rank)
+            self.runSpeculativeCopies(iStage, stageObject, proclog)
+        else:
+            proclog.log(self.VERB3, "Getting end of process signal from Pipeline")
+            self.cppSlice.invokeBarrier(iStage)
         proclog.done()
 
+    def postWorkUnit(self, queue, unit):
+        """
+        Tell the Stage on the next Clipboard in the queue which work unit
+        to process: "workUnit" is the rank of the Slice the work unit
+        belongs to, and "workUnitCancelled" a function that returns True
+        once another copy of it has finished.  Returns a list whose only
+        element becomes True once the Stage has called that function.
+        """
+        polled = [False]
+        def cancelled():
+            polled[0] = True
+            return self.cppSlice.isCancelled(unit)
+
+        clipboard = queue.getNextDataset()
+        clipboard.put("workUnit", unit)
+        clipboard.put("workUnitCancelled", cancelled)
+        queue.addDataset(clipboard)
+        return polled
+
+    def postWorkUnitDescriptor(self, queue):
+        """
+        Give the Stage on the next Clipboard in the queue the descriptor of
+        the work unit of this Slice for the visit, as queued on the
+        Pipeline, under "workUnitDescriptor"
+        """
+        clipboard = queue.getNextDataset()
+        clipboard.put("workUnitDescriptor", self.cppSlice.getWorkUnit())
+        queue.addDataset(clipboard)
+
+    def runSpeculativeCopies(self, iStage, stageObject, proclog):
+        """
+        Re-execute the work units of straggling Slices that the Pipeline
+        hands to this Slice until the speculative Stage is over.  Each copy
+        runs on a fresh Clipboard whose output is discarded: a speculative
+        Stage must write its results to storage.  A failed copy does not
+        count as done, so that the Slice running the original carries on;
+        neither does a copy that never called workUnitCancelled.
+        """
+        inputQueue = self.queueList[iStage-1]
+        outputQueue = self.queueList[iStage]
+        ownClipboard = outputQueue.getNextDataset()
+
+        unit = self.cppSlice.nextWorkUnit()
+        while unit >= 0:
+            proclog.log(self.VERB2, "Re-executing work unit %d" % unit)
+            inputQueue.addDataset(Clipboard())
+            polled = self.postWorkUnit(inputQueue, unit)
+            try:
+                stageObject.applyProcess()
+                outputQueue.getNextDataset().close()
+                if not polled[0]:
+                    proclog.log(Log.WARN, "Copy of work unit %d never called "
+                                "workUnitCancelled" % unit)
+                self.cppSlice.reportWorkUnit(unit, polled[0])
+            except:
+                trace = "".join(traceback.format_exception(
+                    sys.exc_info()[0], sys.exc_info()[1], sys.exc_info()[2]))
+                proclog.log(Log.WARN,
+                            "Copy of work unit %d failed:\n%s" % (unit, trace))
+                self.postOutputClipboard(iStage)
+                outputQueue.getNextDataset().close()
+                self.cppSlice.reportWorkUnit(unit, False)
+
+            unit = self.cppSlice.nextWorkUnit()
+
+        outputQueue.addDataset(ownClipboard)
+
         
 trailingpolicy = re.compile(r'_*(policy|dict)$', re.IGNORECASE)
 
@@ -0,0 +1,87 @@
+#! /usr/bin/env python
+
+#
+# LSST Data Management System
+# Copyright 2008, 2009, 2010 LSST Corporation.
+#
+# This product includes software developed by the
+# LSST Project (http://www.lsst.org/).
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the LSST License Statement and
+# the GNU General Public License along with this program.  If not,
+# see <http://www.lsstcorp.org/LegalNotices/>.
+#
+
+"""
+Applies a reconfiguration posted on the Pipeline with
+Pipeline.postReconfiguration() to the Stages of the Pipeline or of a
+Slice, between visits.
+"""
+
+from lsst.pex.logging import Log
+
+# the typed array getters of PropertySet, tried in turn on a leaf
+_arrayGetters = ("getArrayBool", "getArrayInt", "getArrayLongLong",
+                 "getArrayFloat", "getArrayDouble", "getArrayString")
+
+def getLeafValues(ps, name):
+    """
+    Return the values of the leaf parameter name of the PropertySet ps as
+    a list, whatever their type
+    """
+    for getter in _arrayGetters:
+        try:
+            return list(getattr(ps, getter)(name))
+        except Exception:
+            pass
+    raise RuntimeError("Cannot read the values of %s" % name)
+
+def applyReconfiguration(delta, stageList, log):
+    """
+    Apply a reconfiguration delta, as returned by takeReconfiguration(),
+    to the given Stages: each leaf parameter under "stage-<i>", with its
+    full dotted name, is set in the policy of Stage i, all its values if
+    it has several.  The Stage is then told the names of the parameters
+    that changed through its reconfigure(names) method, if it has one.  A
+    "logThreshold" is set on the log.  The topology is applied by the C++
+    Slice.
+    """
+    if delta.exists("logThreshold"):
+        log.setThreshold(delta.getInt("logThreshold"))
+
+    for iStage in range(1, len(stageList)+1):
+        key = "stage-%d" % iStage
+        if not delta.exists(key):
+            continue
+
+        stageObject = stageList[iStage-1]
+        stagePolicy = getattr(stageObject, "policy", None)
+        if stagePolicy is None:
+            log.log(Log.WARN, "Stage %d has no policy to reconfigure" % iStage)
+            continue
+
+        changes = delta.getPropertySet(key)
+        names = changes.paramNames(False)
+        for name in names:
+            values = getLeafValues(changes, name)
+            if len(values) == 1:
+                stagePolicy.set(name, values[0])
+            else:
+                if stagePolicy.exists(name):
+                    stagePolicy.remove(name)
+                for value in values:
+                    stagePolicy.add(name, value)
+            log.log(Log.INFO, "Stage %d: %s = %s" % (iStage, name, values))
+
+        if hasattr(stageObject, "reconfigure"):
+            stageObject.reconfigure(names)
@@ -21,4 +21,5 @@
 #
 
 
-from mpiharnessLib import Pipeline, Slice
+from mpiharnessLib import Pipeline, Slice, SliceScheduler, Task, ThreadPool, TraceBuffer, \
+    VisitFile, VisitFileReader
@@ -27,7 +27,7 @@ Access to the C++ harness classes from the lsst.pex.mpiharness module
 %enddef
 
 %feature("autodoc", "1");
-%module(package="lsst.pex.mpiharness", docstring=mpiharness_DOCSTRING,  "directors=1") mpiharnessLib
+%module(package="lsst.pex.mpiharness", docstring=mpiharness_DOCSTRING,  "directors=1", threads="1") mpiharnessLib
 
 
 %{
@@ -41,7 +41,14 @@ Access to the C++ harness classes from the lsst.pex.mpiharness module
 #include "lsst/pex/logging/LogRecord.h"
 #include "lsst/pex/logging/Debug.h"
 #include "lsst/pex/mpiharness/Pipeline.h"
+#include "lsst/pex/mpiharness/ThreadPool.h"
+#include "lsst/pex/mpiharness/Payload.h"
+#include "lsst/pex/mpiharness/Prefetcher.h"
+#include "lsst/pex/mpiharness/SyncHandle.h"
+#include "lsst/pex/mpiharness/TraceBuffer.h"
+#include "lsst/pex/mpiharness/VisitFile.h"
 #include "lsst/pex/mpiharness/Slice.h"
+#include "lsst/pex/mpiharness/SliceScheduler.h"
 #include "lsst/pex/harness/TracingLog.h"
 %}
 
@@ -98,6 +105,62 @@ import lsst.pex.mpiharness
 %import "lsst/pex/policy/Policy.h"
 %import "lsst/pex/harness/TracingLog.h"
 
+// Calls that block on MPI or on other threads give up the interpreter lock,
+// so that the shutdown thread and event handling run meanwhile; Python Tasks
+// run by the worker threads re-acquire it through their directors.
+%nothread;
+%thread lsst::pex::mpiharness::ThreadPool::wait;
+%thread lsst::pex::mpiharness::SyncHandle::wait;
+%thread lsst::pex::mpiharness::Pipeline::initialize;
+%thread lsst::pex::mpiharness::Pipeline::startSlices;
+%thread lsst::pex::mpiharness::Pipeline::invokeProcess;
+%thread lsst::pex::mpiharness::Pipeline::startProcess;
+%thread lsst::pex::mpiharness::Pipeline::waitProcess;
+%thread lsst::pex::mpiharness::Pipeline::invokeContinue;
+%thread lsst::pex::mpiharness::Pipeline::invokeShutdown;
+%thread lsst::pex::mpiharness::Pipeline::invokeSyncSlices;
+%thread lsst::pex::mpiharness::Pipeline::gatherShards;
+%thread lsst::pex::mpiharness::Pipeline::agreeOnShutdown;
+%thread lsst::pex::mpiharness::Pipeline::shutdown;
+%thread lsst::pex::mpiharness::Slice::initialize;
+%thread lsst::pex::mpiharness::Slice::invokeBcast;
+%thread lsst::pex::mpiharness::Slice::invokeBarrier;
+%thread lsst::pex::mpiharness::Slice::invokeShutdownTest;
+%thread lsst::pex::mpiharness::Slice::nextWorkUnit;
+%thread lsst::pex::mpiharness::Slice::reportWorkUnit;
+%thread lsst::pex::mpiharness::Slice::calculateNeighbors;
+%thread lsst::pex::mpiharness::Slice::syncSlices;
+%thread lsst::pex::mpiharness::Slice::startSyncSlices;
+%thread lsst::pex::mpiharness::Slice::shutdown;
+%thread lsst::pex::mpiharness::VisitFile::VisitFile;
+%thread lsst::pex::mpiharness::VisitFile::~VisitFile;
+%thread lsst::pex::mpiharness::VisitFile::write;
+%thread lsst::pex::mpiharness::VisitFile::close;
+
+SWIG_SHARED_PTR(TaskPtr, lsst::pex::mpiharness::Task);
+SWIG_SHARED_PTR(ThreadPoolPtr, lsst::pex::mpiharness::ThreadPool);
+SWIG_SHARED_PTR(SyncHandlePtr, lsst::pex::mpiharness::SyncHandle);
+SWIG_SHARED_PTR(VisitFilePtr, lsst::pex::mpiharness::VisitFile);
+SWIG_SHARED_PTR(VisitFileReaderPtr, lsst::pex::mpiharness::VisitFileReader);
+SWIG_SHARED_PTR(PrefetcherPtr, lsst::pex::mpiharness::Prefetcher);
+%feature("director") lsst::pex::mpiharness::Task;
+
+%include "lsst/pex/mpiharness/ThreadPool.h"
+
+// Payloads stay inside the exchange; Python only reads the counters
+%ignore lsst::pex::mpiharness::Payload;
+%include "lsst/pex/mpiharness/Payload.h"
+%ignore lsst::pex::mpiharness::SyncUpdate;
+%include "lsst/pex/mpiharness/SyncHandle.h"
+%include "lsst/pex/mpiharness/TraceBuffer.h"
+
+// Python passes records as a str; the raw forms are for C++ callers
+%ignore lsst::pex::mpiharness::VisitFile::write(const void*, long long);
+%ignore lsst::pex::mpiharness::VisitFile::setCommunicator;
+%ignore lsst::pex::mpiharness::VisitFileReader::getRecordData;
+%include "lsst/pex/mpiharness/VisitFile.h"
+%include "lsst/pex/mpiharness/Prefetcher.h"
 %include "lsst/pex/mpiharness/Pipeline.h"
 %include "lsst/pex/mpiharness/Slice.h"
+%include "lsst/pex/mpiharness/SliceScheduler.h"
 
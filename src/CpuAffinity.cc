@@ -0,0 +1,285 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file CpuAffinity.cc
+  *
+  * \ingroup mpiharness
+  *
+  * \brief   CpuAffinity places a Slice on the cores and NUMA memory of its node.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "lsst/pex/mpiharness/CpuAffinity.h"
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+namespace {
+    const char* const nodeDirectory = "/sys/devices/system/node";
+
+    /* Take count entries of list starting at start, wrapping around */
+    std::vector<int> take(const std::vector<int>& list, int start, int count) {
+        std::vector<int> result;
+        for (int i = 0; i < count && !list.empty(); i++) {
+            result.push_back(list[(start + i) % list.size()]);
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+}
+
+/**
+ * Constructor.  Finds the cores this process may run on, grouped by NUMA
+ * node.  If the node topology is not available all cores form one group
+ * and memory is left unbound.
+ */
+CpuAffinity::CpuAffinity() {
+
+    std::vector<bool> allowed(CPU_SETSIZE, false);
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            allowed[i] = CPU_ISSET(i, &mask);
+        }
+    }
+
+    std::map<int, std::vector<int> > nodes;
+    DIR* dir = opendir(nodeDirectory);
+    if (dir != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            std::string name(entry->d_name);
+            if (name.compare(0, 4, "node") != 0 || name.size() == 4 ||
+                name[4] < '0' || name[4] > '9') {
+                continue;
+            }
+            std::ifstream is((std::string(nodeDirectory) + "/" + name + "/cpulist").c_str());
+            std::string text;
+            std::getline(is, text);
+
+            std::vector<int> cpus = parseList(text);
+            std::vector<int>& usable = nodes[std::atoi(name.c_str() + 4)];
+            for (unsigned int i = 0; i < cpus.size(); i++) {
+                if (cpus[i] < CPU_SETSIZE && allowed[cpus[i]]) {
+                    usable.push_back(cpus[i]);
+                }
+            }
+        }
+        closedir(dir);
+    }
+
+    std::map<int, std::vector<int> >::iterator iter;
+    for (iter = nodes.begin(); iter != nodes.end(); iter++) {
+        if (!iter->second.empty()) {
+            _nodeIds.push_back(iter->first);
+            _nodeCpus.push_back(iter->second);
+        }
+    }
+
+    if (_nodeCpus.empty()) {
+        std::vector<int> cpus;
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            if (allowed[i]) {
+                cpus.push_back(i);
+            }
+        }
+        _nodeIds.push_back(-1);
+        _nodeCpus.push_back(cpus);
+    }
+}
+
+/**
+ * Constructor for a given topology, e.g. that of another node.
+ * @param nodeCpus   the cores of each NUMA node, numbered from 0
+ */
+CpuAffinity::CpuAffinity(const std::vector<std::vector<int> >& nodeCpus) {
+    for (unsigned int i = 0; i < nodeCpus.size(); i++) {
+        if (!nodeCpus[i].empty()) {
+            _nodeIds.push_back(i);
+            _nodeCpus.push_back(nodeCpus[i]);
+        }
+    }
+    if (_nodeCpus.empty()) {
+        _nodeIds.push_back(-1);
+        _nodeCpus.push_back(std::vector<int>());
+    }
+}
+
+/** Choose the cores of a Slice.
+ * @param strategy    "compact", "scatter" or "numa"
+ * @param localRank   the rank of the Slice among the Slices of its node
+ * @param localSize   the number of Slices on the node
+ * @return the cores, or none if the strategy is "none" or there are no cores
+ */
+std::vector<int> CpuAffinity::choose(const std::string& strategy, int localRank,
+                                     int localSize) const {
+
+    int nNodes = _nodeCpus.size();
+    if (localSize < 1) {
+        localSize = 1;
+    }
+
+    if (strategy == "compact") {
+        std::vector<int> all;
+        for (int i = 0; i < nNodes; i++) {
+            all.insert(all.end(), _nodeCpus[i].begin(), _nodeCpus[i].end());
+        }
+        int count = std::max(1, static_cast<int>(all.size()) / localSize);
+        return take(all, localRank * count, count);
+    }
+
+    if (strategy == "scatter") {
+        int node = localRank % nNodes;
+        int onNode = (localSize - node + nNodes - 1) / nNodes;
+        int count = std::max(1, static_cast<int>(_nodeCpus[node].size()) / onNode);
+        return take(_nodeCpus[node], (localRank / nNodes) * count, count);
+    }
+
+    if (strategy == "numa") {
+        return _nodeCpus[localRank % nNodes];
+    }
+
+    return std::vector<int>();
+}
+
+/** get the NUMA nodes the given cores belong to; none if unknown
+ */
+std::vector<int> CpuAffinity::getNodes(const std::vector<int>& cpus) const {
+    std::vector<int> nodes;
+    for (unsigned int i = 0; i < _nodeCpus.size(); i++) {
+        if (_nodeIds[i] < 0) {
+            continue;
+        }
+        for (unsigned int j = 0; j < cpus.size(); j++) {
+            if (std::find(_nodeCpus[i].begin(), _nodeCpus[i].end(), cpus[j]) != _nodeCpus[i].end()) {
+                nodes.push_back(_nodeIds[i]);
+                break;
+            }
+        }
+    }
+    return nodes;
+}
+
+/** Bind the calling thread to the given cores and its memory allocations
+ * to their NUMA nodes.  Threads started afterwards inherit both.
+ * @return false if the kernel refused either binding
+ */
+bool CpuAffinity::apply(const std::vector<int>& cpus) const {
+
+    if (cpus.empty()) {
+        return true;
+    }
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for (unsigned int i = 0; i < cpus.size(); i++) {
+        CPU_SET(cpus[i], &mask);
+    }
+    if (sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+        return false;
+    }
+
+    std::vector<int> nodes = getNodes(cpus);
+    if (nodes.empty()) {
+        return true;
+    }
+
+    const int bitsPerWord = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> nodeMask(nodes.back() / bitsPerWord + 1, 0);
+    for (unsigned int i = 0; i < nodes.size(); i++) {
+        nodeMask[nodes[i] / bitsPerWord] |= 1UL << (nodes[i] % bitsPerWord);
+    }
+    return syscall(SYS_set_mempolicy, MPOL_BIND, &nodeMask[0],
+                   nodeMask.size() * bitsPerWord + 1) == 0;
+}
+
+/** Whether the name is that of a placement strategy, including "none"
+ */
+bool CpuAffinity::isStrategy(const std::string& strategy) {
+    return strategy == "none" || strategy == "compact" ||
+           strategy == "scatter" || strategy == "numa";
+}
+
+/** Parse a kernel cpu list such as "0-3,8-11"; the inverse of format()
+ */
+std::vector<int> CpuAffinity::parseList(const std::string& text) {
+    std::vector<int> list;
+    std::istringstream is(text);
+    std::string range;
+    while (std::getline(is, range, ',')) {
+        if (range.empty() || range[0] < '0' || range[0] > '9') {
+            continue;
+        }
+        int first = std::atoi(range.c_str());
+        int last = first;
+        std::string::size_type dash = range.find('-');
+        if (dash != std::string::npos) {
+            last = std::atoi(range.c_str() + dash + 1);
+        }
+        for (int i = first; i <= last; i++) {
+            list.push_back(i);
+        }
+    }
+    return list;
+}
+
+/** Format a sorted list of numbers as a kernel cpu list, e.g. "0-3,8"
+ */
+std::string CpuAffinity::format(const std::vector<int>& list) {
+    std::ostringstream os;
+    for (unsigned int i = 0; i < list.size(); ) {
+        unsigned int j = i;
+        while (j + 1 < list.size() && list[j + 1] == list[j] + 1) {
+            j++;
+        }
+        if (i > 0) {
+            os << ",";
+        }
+        os << list[i];
+        if (j > i) {
+            os << "-" << list[j];
+        }
+        i = j + 1;
+    }
+    return os.str();
+}
+
+}
+}
+}
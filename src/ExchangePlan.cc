@@ -0,0 +1,254 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file ExchangePlan.cc
+  *
+  * \ingroup mpiharness
+  *
+  * \brief   ExchangePlan holds the persistent requests and buffers of the
+  *          interSlice exchanges of a Slice.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#include <cstdlib>
+#include <sstream>
+
+#include "lsst/pex/mpiharness/ExchangePlan.h"
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+namespace {
+    /* The first part of each Payload, up to the capacity of the receive */
+    const int SYNC_TAG = 0;
+    /* The rest of a Payload larger than the capacity */
+    const int SYNC_OVERFLOW_TAG = 1;
+}
+
+const int ExchangePlan::INITIAL_CAPACITY;
+
+/**
+ * Constructor.  Sets up the persistent receives.
+ * @param comm            the communicator of the Slices
+ * @param sendNeighbors   the ranks of the Slices data is sent to
+ * @param recvNeighbors   the ranks of the Slices data is received from
+ */
+ExchangePlan::ExchangePlan(MPI_Comm comm, const std::list<int>& sendNeighbors,
+                           const std::list<int>& recvNeighbors)
+    : _comm(comm), _sendNeighbors(sendNeighbors.begin(), sendNeighbors.end()),
+      _recvNeighbors(recvNeighbors.begin(), recvNeighbors.end()),
+      _sendCapacity(INITIAL_CAPACITY), _sentBytes(0), _overflow(false),
+      _sendRequests(sendNeighbors.size(), MPI_REQUEST_NULL),
+      _overflowRequests(sendNeighbors.size(), MPI_REQUEST_NULL),
+      _received(recvNeighbors.size()), _recvCapacity(recvNeighbors.size(), INITIAL_CAPACITY),
+      _recvBytes(recvNeighbors.size(), 0),
+      _recvRequests(recvNeighbors.size(), MPI_REQUEST_NULL),
+      _recvStatuses(recvNeighbors.size()),
+      _active(false), _recvComplete(false), _rebuilds(0)
+{
+    for (unsigned int i = 0; i < _recvNeighbors.size(); i++) {
+        std::ostringstream key;
+        key << "neighbor-" << _recvNeighbors[i];
+        _recvKeys.push_back(key.str());
+
+        _received[i].reserve(INITIAL_CAPACITY);
+        initRecv(i);
+    }
+}
+
+/** Destructor.  An exchange in flight is completed first, as MPI requires.
+ */
+ExchangePlan::~ExchangePlan(void) {
+    wait();
+    freeRequests(_recvRequests);
+}
+
+/** Start an exchange of the Payload packed with getSendPayload().  The
+ * receives are started before the sends.
+ */
+void ExchangePlan::start() {
+
+    int wireSize = _sendPayload.getWireSize();
+    int firstSize = (wireSize < _sendCapacity) ? wireSize : _sendCapacity;
+
+    int mpiError;
+    if (!_recvRequests.empty()) {
+        mpiError = MPI_Startall(_recvRequests.size(), &_recvRequests[0]);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+
+    /* Only the Payload goes on the wire, never the rest of the capacity */
+    for (unsigned int i = 0; i < _sendNeighbors.size(); i++) {
+        mpiError = MPI_Isend(_sendPayload.getBuffer(), firstSize, MPI_BYTE, _sendNeighbors[i],
+                             SYNC_TAG, _comm, &_sendRequests[i]);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+    _sentBytes = wireSize;
+    PayloadStats::getInstance().recordSend(static_cast<long long>(wireSize) * _sendNeighbors.size());
+
+    /* The neighbors take the rest with an ordinary receive, then grow */
+    _overflow = (wireSize > _sendCapacity);
+    if (_overflow) {
+        for (unsigned int i = 0; i < _sendNeighbors.size(); i++) {
+            mpiError = MPI_Isend(_sendPayload.getBuffer() + _sendCapacity, wireSize - _sendCapacity,
+                                 MPI_BYTE, _sendNeighbors[i], SYNC_OVERFLOW_TAG, _comm, 
+                                 &_overflowRequests[i]);
+            if (mpiError != MPI_SUCCESS){
+                MPI_Finalize();
+                exit(1);
+            }
+        }
+        _sendCapacity = grow(_sendCapacity, wireSize);
+    }
+
+    _active = true;
+    _recvComplete = false;
+}
+
+/** Progress the exchange without blocking.
+ * @return true once all sends and receives of the capacity have completed
+ */
+bool ExchangePlan::test() {
+
+    if (!_active) {
+        return true;
+    }
+
+    /* Completed receives are not tested again */
+    int recvDone = 1;
+    int sendDone = 1;
+    if (!_recvComplete && !_recvRequests.empty()) {
+        MPI_Testall(_recvRequests.size(), &_recvRequests[0], &recvDone, &_recvStatuses[0]);
+        _recvComplete = recvDone;
+    }
+    if (!_sendRequests.empty()) {
+        MPI_Testall(_sendRequests.size(), &_sendRequests[0], &sendDone, MPI_STATUSES_IGNORE);
+    }
+    return recvDone && sendDone;
+}
+
+/** Block until the exchange has completed, taking in the rest of any
+ * Payload larger than the capacity and growing the receive for it.
+ */
+void ExchangePlan::wait() {
+
+    if (!_active) {
+        return;
+    }
+
+    int mpiError;
+    if (!_recvComplete && !_recvRequests.empty()) {
+        mpiError = MPI_Waitall(_recvRequests.size(), &_recvRequests[0], &_recvStatuses[0]);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+
+    /* The Header tells whether the rest of the Payload follows */
+    for (unsigned int i = 0; i < _recvNeighbors.size(); i++) {
+        int count = _recvCapacity[i];
+        int wireSize = _received[i].getWireSize();
+        MPI_Get_count(&_recvStatuses[i], MPI_BYTE, &_recvBytes[i]);
+        if (wireSize <= count) {
+            continue;
+        }
+
+        _recvCapacity[i] = grow(_recvCapacity[i], wireSize);
+        _received[i].reserve(_recvCapacity[i]);
+        mpiError = MPI_Recv(_received[i].getBuffer() + count, wireSize - count, MPI_BYTE,
+                            _recvNeighbors[i], SYNC_OVERFLOW_TAG, _comm, MPI_STATUS_IGNORE);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+        _recvBytes[i] += wireSize - count;
+        initRecv(i);
+        _rebuilds++;
+    }
+
+    if (!_sendRequests.empty()) {
+        mpiError = MPI_Waitall(_sendRequests.size(), &_sendRequests[0], MPI_STATUSES_IGNORE);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+    if (_overflow) {
+        mpiError = MPI_Waitall(_overflowRequests.size(), &_overflowRequests[0], MPI_STATUSES_IGNORE);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+        _overflow = false;
+    }
+
+    _active = false;
+}
+
+/** The capacity after a Payload of wireSize bytes, the same on both sides
+ */
+int ExchangePlan::grow(int capacity, int wireSize) {
+    while (capacity < wireSize) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+/** Set up the persistent receive from the i-th neighbor at its capacity.
+ */
+void ExchangePlan::initRecv(int i) {
+
+    if (_recvRequests[i] != MPI_REQUEST_NULL) {
+        MPI_Request_free(&_recvRequests[i]);
+    }
+    int mpiError = MPI_Recv_init(_received[i].getBuffer(), _recvCapacity[i], MPI_BYTE,
+                                 _recvNeighbors[i], SYNC_TAG, _comm, &_recvRequests[i]);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+}
+
+/** Free inactive persistent requests.
+ */
+void ExchangePlan::freeRequests(std::vector<MPI_Request>& requests) {
+    for (unsigned int i = 0; i < requests.size(); i++) {
+        if (requests[i] != MPI_REQUEST_NULL) {
+            MPI_Request_free(&requests[i]);
+        }
+    }
+}
+
+}
+}
+}
@@ -0,0 +1,125 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file MemoryUsage.cc
+  *
+  * \ingroup mpiharness
+  *
+  * \brief   MemoryUsage samples the memory used by a Slice and by its node.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "lsst/pex/mpiharness/MemoryUsage.h"
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+namespace {
+    /* Read a "Key:   1234 kB" line of a /proc file; -1 if it is missing */
+    double readKilobytes(const char* filename, const char* key) {
+        std::ifstream is(filename);
+        std::string line;
+        size_t length = std::strlen(key);
+        while (std::getline(is, line)) {
+            if (line.compare(0, length, key) == 0 && line.size() > length &&
+                line[length] == ':') {
+                return std::atof(line.c_str() + length + 1);
+            }
+        }
+        return -1.0;
+    }
+}
+
+/** get the resident size of this process in MB
+ */
+double MemoryUsage::getRss() {
+    double kb = readKilobytes("/proc/self/status", "VmRSS");
+    return (kb > 0.0) ? kb / 1024.0 : 0.0;
+}
+
+/** get the largest resident size this process has had since it started or
+ * since resetPeakRss(), in MB
+ */
+double MemoryUsage::getPeakRss() {
+    double kb = readKilobytes("/proc/self/status", "VmHWM");
+    return (kb > 0.0) ? kb / 1024.0 : 0.0;
+}
+
+/** Restart the peak resident size of this process from its current 
+ * resident size, by writing "5" to /proc/self/clear_refs (Linux 4.0 on).
+ * @return whether the peak was reset; if not, getPeakRss() keeps giving 
+ *         the peak over the life of the process
+ */
+bool MemoryUsage::resetPeakRss() {
+    std::ofstream os("/proc/self/clear_refs");
+    if (!os) {
+        return false;
+    }
+    os << "5" << std::flush;
+    return static_cast<bool>(os);
+}
+
+/** get the fraction of the memory of the node in use, i.e. not available 
+ * to new allocations without swapping.  Kernels that do not report 
+ * MemAvailable count free memory plus the buffers and page cache.
+ */
+double MemoryUsage::getNodeUsed() {
+    double total = readKilobytes("/proc/meminfo", "MemTotal");
+    if (total <= 0.0) {
+        return 0.0;
+    }
+    double available = readKilobytes("/proc/meminfo", "MemAvailable");
+    if (available < 0.0) {
+        available = readKilobytes("/proc/meminfo", "MemFree") + 
+                    readKilobytes("/proc/meminfo", "Buffers") + 
+                    readKilobytes("/proc/meminfo", "Cached");
+    }
+    return 1.0 - available / total;
+}
+
+/** Fill the memory fields of a Stage report of REPORT_FIELDS entries.
+ * @param report     the report to fill
+ * @param rssBegin   the resident size at the start of the Stage, in MB
+ * @param rank       the rank of the Slice
+ */
+void MemoryUsage::sample(ReportLoc* report, double rssBegin, int rank) {
+    report[REPORT_RSS_BEGIN].value = rssBegin;
+    report[REPORT_RSS_END].value = getRss();
+    report[REPORT_PEAK_RSS].value = getPeakRss();
+    report[REPORT_NODE_USED].value = getNodeUsed();
+    for (int i = 0; i < REPORT_FIELDS; i++) {
+        report[i].rank = rank;
+    }
+}
+
+}
+}
+}
@@ -0,0 +1,220 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file Payload.cc
+  *
+  * \ingroup mpiharness
+  *
+  * \brief   Payload carries a serialized PropertySet between Slices,
+  *          compressed if it is large enough.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#include <cstring>
+
+#include <boost/format.hpp>
+#include <zlib.h>
+
+#include "lsst/pex/mpiharness/Payload.h"
+#include "lsst/pex/exceptions.h"
+
+namespace pexExcept = lsst::pex::exceptions;
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/**
+ * Constructor.  An empty, uncompressed Payload to receive into.
+ */
+Payload::Payload() {
+    reserve(sizeof(Header));
+    header().codec = CODEC_NONE;
+    header().rawSize = 0;
+    header().size = 0;
+}
+
+/** Make room for at least the given number of bytes, Header included.  
+ * The contents are kept; the buffer may move.
+ */
+void Payload::reserve(int capacity) {
+    if (capacity > getCapacity()) {
+        _buffer.resize(capacity);
+    }
+}
+
+/** Fill the Payload from a packed archive.
+ * @param archive     the archive holding the serialized PropertySet
+ * @param threshold   compress archives of at least this many bytes; a
+ *                    negative threshold turns compression off
+ */
+void Payload::pack(const boost::mpi::packed_oarchive& archive, int threshold) {
+
+    double start = MPI_Wtime();
+
+    const char* raw = static_cast<const char*>(archive.address());
+    int rawSize = archive.size();
+    int codec = CODEC_NONE;
+    int size = rawSize;
+
+    if (threshold >= 0 && rawSize >= threshold) {
+        uLongf length = compressBound(rawSize);
+        reserve(sizeof(Header) + length);
+        if (compress2(reinterpret_cast<Bytef*>(getBuffer() + sizeof(Header)), &length,
+                      reinterpret_cast<const Bytef*>(raw), rawSize,
+                      Z_BEST_SPEED) == Z_OK && length < static_cast<uLongf>(rawSize)) {
+            codec = CODEC_ZLIB;
+            size = length;
+        }
+    }
+    if (codec == CODEC_NONE) {
+        reserve(sizeof(Header) + rawSize);
+        if (rawSize > 0) {
+            std::memcpy(getBuffer() + sizeof(Header), raw, rawSize);
+        }
+    }
+
+    header().codec = codec;
+    header().rawSize = rawSize;
+    header().size = size;
+
+    PayloadStats::getInstance().recordPack(rawSize, size, codec != CODEC_NONE,
+                                           MPI_Wtime() - start);
+}
+
+/** Restore the packed archive the Payload was filled from.
+ * @param archive   an empty archive to restore into
+ * @throw lsst::pex::exceptions::RuntimeErrorException if the Payload is corrupt
+ */
+void Payload::unpack(boost::mpi::packed_iarchive& archive) const {
+
+    double start = MPI_Wtime();
+
+    int rawSize = getRawSize();
+    int size = getSize();
+    if (rawSize < 0 || size < 0 || getWireSize() > getCapacity()) {
+        throw LSST_EXCEPT(pexExcept::RuntimeErrorException,
+                          "Truncated Payload received from a neighbor Slice");
+    }
+
+    archive.resize(rawSize);
+    if (rawSize == 0) {
+        return;
+    }
+
+    const Bytef* data = reinterpret_cast<const Bytef*>(&_buffer[0] + sizeof(Header));
+    if (getCodec() == CODEC_ZLIB) {
+        uLongf length = rawSize;
+        if (uncompress(static_cast<Bytef*>(archive.address()), &length, data, size) != Z_OK ||
+            length != static_cast<uLongf>(rawSize)) {
+            throw LSST_EXCEPT(pexExcept::RuntimeErrorException,
+                              "Cannot decompress a Payload received from a neighbor Slice");
+        }
+        PayloadStats::getInstance().recordUnpack(MPI_Wtime() - start);
+    }
+    else if (getCodec() == CODEC_NONE && size == rawSize) {
+        std::memcpy(archive.address(), data, rawSize);
+    }
+    else {
+        throw LSST_EXCEPT(pexExcept::RuntimeErrorException,
+                          "Unknown codec in a Payload received from a neighbor Slice");
+    }
+}
+
+/**
+ * Constructor.  All counters start at zero.
+ */
+PayloadStats::PayloadStats() {
+    reset();
+}
+
+/** Count a packed Payload.
+ * @param rawSize      the size of the archive
+ * @param size         the size sent
+ * @param compressed   whether the Payload was compressed
+ * @param seconds      the time spent packing it
+ */
+void PayloadStats::recordPack(int rawSize, int size, bool compressed, double seconds) {
+    _messages++;
+    _rawBytes += rawSize;
+    _wireBytes += size;
+    if (compressed) {
+        _compressed++;
+    }
+    _compressTime += seconds;
+}
+
+/** Count the bytes put on the wire by an exchange, to all neighbors.
+ */
+void PayloadStats::recordSend(long long bytes) {
+    _sentBytes += bytes;
+}
+
+/** Count the time spent decompressing a received Payload.
+ */
+void PayloadStats::recordUnpack(double seconds) {
+    _decompressTime += seconds;
+}
+
+/** Set all counters back to zero.
+ */
+void PayloadStats::reset() {
+    _messages = 0;
+    _compressed = 0;
+    _rawBytes = 0;
+    _wireBytes = 0;
+    _sentBytes = 0;
+    _compressTime = 0.0;
+    _decompressTime = 0.0;
+}
+
+/** get the ratio of the archive bytes to the bytes sent; 1 if nothing was sent
+ */
+double PayloadStats::getRatio() const {
+    if (_wireBytes == 0) {
+        return 1.0;
+    }
+    return static_cast<double>(_rawBytes) / _wireBytes;
+}
+
+/** Summarize the counters in one line.
+ */
+std::string PayloadStats::toString() const {
+    return (boost::format("%d payloads, %d compressed, %d bytes sent as %d (ratio %.2f), "
+                          "%d bytes on the wire, compress %.6f s decompress %.6f s")
+            % _messages % _compressed % _rawBytes % _wireBytes % getRatio()
+            % _sentBytes % _compressTime % _decompressTime).str();
+}
+
+/** Return the counters of this process.
+ */
+PayloadStats& PayloadStats::getInstance() {
+    static PayloadStats stats;
+    return stats;
+}
+
+}
+}
+}
@@ -35,24 +35,55 @@
   *
   * \author  Greg Daues, NCSA
   */
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
 #include <sstream>
+#include <sys/time.h>
+
+#include <boost/mpi.hpp>
+#include <boost/serialization/shared_ptr.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "lsst/pex/mpiharness/Pipeline.h"
+#include "lsst/pex/mpiharness/Control.h"
+#include "lsst/pex/mpiharness/MemoryUsage.h"
+#include "lsst/pex/mpiharness/SliceScheduler.h"
+#include "lsst/pex/mpiharness/TraceBuffer.h"
 
 using lsst::pex::logging::Log;
 
+namespace pexExcept = lsst::pex::exceptions;
+
 namespace lsst {
 namespace pex {
 namespace mpiharness {
 
+namespace {
+    /* Seconds since the epoch, which visit deadlines are given in */
+    double getWallTime() {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        return now.tv_sec + 1.0e-6 * now.tv_usec;
+    }
+}
+
 /** 
  * Constructor.
  * @param name   a name to identify the pipeline.  This is used in setting 
  *                 up the logger.
  */
 Pipeline::Pipeline(const std::string& name) 
-    : _pid(getpid()),  _pipename(name), _logutils(LogUtils())
+    : _pid(getpid()), nStages(0), pipelineRank(0), pipelineSize(1),
+      schedulerRank(-1), schedulerWeight(1), nTenants(0),
+      sliceThreads(1), sliceThreadLevel("funneled"), controlGroupSize(0),
+      sliceAffinity("none"),
+      speculationThreshold(0.75), speculationFactor(1.5), speculationSequence(0),
+      pendingReports(0), nLeaders(0), pendingDone(0), processStage(0), processSpeculative(false),
+      visitHandshake(false), slicesPaused(false), draining(false), memoryAccounting(false), memoryThreshold(0.0), memoryWaitLimit(600.0),
+      visitQueueOn(false), visitCount(0), lookaheadSent(false), visitPriority(0), 
+      visitDeadline(0.0), visitQueuedAt(0.0), stageDispatchedAt(0.0),
+      _pipename(name), _logutils(LogUtils())
 { }
 
 /** Destructor.
@@ -75,7 +106,11 @@ void Pipeline::initialize() {
 
 /** Initialize the MPI environment of the Pipeline.
  * Check the rank, size of MPI_COMM_WORLD, and the universe size 
- * prior to the spawning of the Slices. 
+ * prior to the spawning of the Slices.  If a SliceScheduler was launched
+ * alongside, the Slice pool is shared: by default each Pipeline spawns a 
+ * Slice for every core of the pool, the Slices of the Pipelines sleep 
+ * while idle, and the SliceScheduler hands out the cores.  All the Pipeline ranks started for this Pipeline form 
+ * pipelineComm; the Slices get the rest of the universe.
  */
 void Pipeline::initializeMPI() {
   
@@ -106,7 +141,36 @@ void Pipeline::initializeMPI() {
     }
     universeSize = *universeSizep;
 
-    nSlices = universeSize-1;
+    mpiError = SliceScheduler::locate(false, &pipelineComm, &schedulerRank, &nTenants);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    mpiError = MPI_Comm_rank(pipelineComm, &pipelineRank);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    mpiError = MPI_Comm_size(pipelineComm, &pipelineSize);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    if (schedulerRank < 0) {
+        nSlices = universeSize - pipelineSize;
+        if (nSlices < 1) {
+            nSlices = 1;
+        }
+    }
+    else {
+        nSlices = universeSize - size;
+        if (nSlices < 1) {
+            nSlices = 1;
+        }
+    }
 
     return;
 }
@@ -124,23 +188,145 @@ int Pipeline::getUniverseSize() {
     return universeSize;
 }
 
+/** set method for the number of Slices to spawn.  Must be called before 
+ * startSlices() to take effect.
+ */ 
+void Pipeline::setSliceCount(int count) {
+    if (count > 0) {
+        nSlices = count;
+    }
+}
+
+/** get method for the number of Slices to spawn
+ */ 
+int Pipeline::getSliceCount() {
+    return nSlices;
+}
+
+/** set method for the fair-share weight of this Pipeline in a shared Slice pool
+ */ 
+void Pipeline::setSchedulerWeight(int weight) {
+    if (weight > 0) {
+        schedulerWeight = weight;
+    }
+}
+
+/** set method for the number of threads in the ThreadPool of each Slice
+ */ 
+void Pipeline::setSliceThreads(int nThreads) {
+    if (nThreads > 0) {
+        sliceThreads = nThreads;
+    }
+}
+
+/** set method for the MPI thread level requested by each Slice: one of
+ * "single", "funneled", "serialized" or "multiple"
+ */ 
+void Pipeline::setSliceThreadLevel(const std::string& level) {
+    sliceThreadLevel = level;
+}
+
+/** set method for the size of the Slice groups of the control tree.  By 
+ * default (0) the Slices are grouped by node.
+ */ 
+void Pipeline::setControlGroupSize(int groupSize) {
+    controlGroupSize = (groupSize > 0) ? groupSize : 0;
+}
+
+/** set method for the placement of each Slice on the cores of its node: one
+ * of "none", "compact", "scatter" or "numa"
+ */ 
+void Pipeline::setSliceAffinity(const std::string& strategy) {
+    sliceAffinity = strategy;
+}
+
+/** Mark a Stage as speculative: once most of its work units are done, the
+ * work units of straggling Slices are re-executed on idle Slices and the 
+ * first copy to finish is kept.  Only suitable for Stages whose work unit 
+ * is self-contained, i.e. read from and written to storage, and that poll
+ * for cancellation (see MpiSlice.postWorkUnit).
+ */ 
+void Pipeline::setSpeculativeStage(int iStage) {
+    speculativeStages.insert(iStage);
+}
+
+/** set method for the fraction of the work units of a speculative Stage 
+ * that must be done before stragglers are re-executed
+ */ 
+void Pipeline::setSpeculationThreshold(double threshold) {
+    if (threshold > 0.0 && threshold <= 1.0) {
+        speculationThreshold = threshold;
+    }
+}
+
+/** set method for how many times the median work unit time a work unit 
+ * must have run before it counts as a straggler
+ */ 
+void Pipeline::setSpeculationFactor(double factor) {
+    if (factor >= 1.0) {
+        speculationFactor = factor;
+    }
+}
+
+/** set method for memory accounting: at the end of every non-speculative 
+ * Stage the Slices report their memory use, which getMemoryUsage() returns.
+ * The Slices must be set up the same way.
+ */ 
+void Pipeline::setMemoryAccounting(bool accounting) {
+    memoryAccounting = accounting;
+}
+
+/** set method for the fraction of the memory of a node in use above which 
+ * invokeContinue() holds back the next visit; 0 never holds it back
+ */ 
+void Pipeline::setMemoryThreshold(double threshold) {
+    if (threshold >= 0.0 && threshold <= 1.0) {
+        memoryThreshold = threshold;
+    }
+}
+
+/** set method for the longest time in seconds invokeContinue() holds back
+ * a visit for memory before dispatching it anyway; 0 waits for as long as it takes
+ */ 
+void Pipeline::setMemoryWaitLimit(double seconds) {
+    if (seconds >= 0.0) {
+        memoryWaitLimit = seconds;
+    }
+}
+
 /** Spawn the Slice workers for parallel computation. 
  * This is accomplished using MPI_Comm_spawn and creates an Intercommunicator sliceIntercomm.
- * The number of Slices to be spawned nSlices is one less than the designated universe size.
+ * The number of Slices to be spawned nSlices is one less than the designated universe size,
+ * unless the Slice pool is shared with other Pipelines.
+ * Commands then travel down a two-level control tree: the Pipeline talks to one
+ * leader Slice per node (controlIntercomm), which relays to the other Slices on its node.
  */ 
 void Pipeline::startSlices() {
-    int *array_of_errcodes;
-    array_of_errcodes = (int *) malloc(4 * sizeof (int));
 
     std::ostringstream levsb;
     levsb << _logutils.getLogger().getThreshold();
     string levstr(levsb.str());
-    char *lev = (char *) malloc(levstr.length());
-    strcpy(lev, levstr.c_str());
 
-    int errcodes[nSlices];
     char *myexec  = "runMpiSlice.py";
-    char *argv[] = {_policyName, _runId, "-l", lev, NULL};
+    std::ostringstream thrsb;
+    thrsb << sliceThreads;
+    string thrstr(thrsb.str());
+    std::ostringstream grpsb;
+    grpsb << controlGroupSize;
+    string grpstr(grpsb.str());
+
+    char *argv[] = {_policyName, _runId, "-l", (char *) levstr.c_str(), 
+                    "-w", (char *) thrstr.c_str(), "-t", (char *) sliceThreadLevel.c_str(), 
+                    "-g", (char *) grpstr.c_str(), "-a", (char *) sliceAffinity.c_str(), 
+                    NULL, NULL, NULL};
+    int argc = 12;
+    if (schedulerRank >= 0) {
+        argv[argc++] = (char *) "-s";
+    }
+    /* A Slice only prefetches when there are descriptors to wait for */
+    if (visitQueueOn) {
+        argv[argc++] = (char *) "-q";
+    }
     if (_logutils.getLogger().sends(Log::DEBUG)) {
         Log log(_logutils.getLogger(), "startSlices.cpp");
         std::ostringstream spawncmd;
@@ -151,36 +337,152 @@ void Pipeline::startSlices() {
         log.log(Log::DEBUG, spawncmd.str());
     }
 
-    mpiError = MPI_Comm_spawn(myexec, argv, nSlices, MPI_INFO_NULL, 0, MPI_COMM_WORLD, &sliceIntercomm, errcodes); 
+    mpiError = MPI_Comm_spawn(myexec, argv, nSlices, MPI_INFO_NULL, 0, pipelineComm, &sliceIntercomm, 
+                              MPI_ERRCODES_IGNORE); 
+
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
 
+    /* Slice 0 always leads its node group and the group of node leaders; 
+       it follows the Pipeline ranks in harnessComm */
+    mpiError = MPI_Intercomm_merge(sliceIntercomm, 0, &harnessComm);
     if (mpiError != MPI_SUCCESS){
         MPI_Finalize();
         exit(1);
     }
 
+    mpiError = MPI_Intercomm_create(pipelineComm, 0, harnessComm, pipelineSize, CONTROL_TREE_TAG, 
+                                    &controlIntercomm);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    mpiError = MPI_Comm_remote_size(controlIntercomm, &nLeaders);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    Log log(_logutils.getLogger(), "startSlices.cpp");
+    log.log(Log::INFO, boost::format("Control tree: %d Slices under %d leaders, Pipeline rank %d of %d") 
+            % nSlices % nLeaders % pipelineRank % pipelineSize);
+
+    registerTenant();
+
     return;
 }
 
-/** Broadcast a Shutdown message to all of the Slices.
+/** Register this Pipeline with the SliceScheduler, if there is one.  The
+ * root speaks to the SliceScheduler for all the Pipeline ranks.
  */
-void Pipeline::invokeShutdown() {
+void Pipeline::registerTenant() {
 
-    char procCommand[bufferSize];
+    if (schedulerRank < 0 || !isRoot()) {
+        return;
+    }
 
-    std::strcpy(procCommand, "SHUTDOWN");  
+    int msg[3] = { SCHEDULER_REGISTER, nSlices, schedulerWeight };
+    int capacity;
+
+    mpiError = MPI_Send(msg, 3, MPI_INT, schedulerRank, SCHEDULER_TAG, MPI_COMM_WORLD);
+    if (mpiError != MPI_SUCCESS) {
+        MPI_Finalize();
+        exit(1);
+    }
+
+    mpiError = MPI_Recv(&capacity, 1, MPI_INT, schedulerRank, SCHEDULER_TAG,
+                        MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    if (mpiError != MPI_SUCCESS) {
+        MPI_Finalize();
+        exit(1);
+    }
+
+    Log log(_logutils.getLogger(), "registerTenant.cpp");
+    log.log(Log::INFO,
+        boost::format("Sharing a pool of %d Slices with %d Pipelines: %d Slices weight %d") 
+        % capacity % nTenants % nSlices % schedulerWeight);
+}
+
+/** Wait until the SliceScheduler grants this Pipeline its share of the 
+ * Slice pool, for the priority of the current visit.  Returns at once if 
+ * the pool is not shared.
+ */
+void Pipeline::acquireSlicePool() {
+
+    if (schedulerRank < 0 || !isRoot()) {
+        return;
+    }
+
+    int msg[3] = { SCHEDULER_ACQUIRE, visitPriority, 0 };
+    int granted;
+
+    mpiError = MPI_Send(msg, 3, MPI_INT, schedulerRank, SCHEDULER_TAG, MPI_COMM_WORLD);
+    if (mpiError != MPI_SUCCESS) {
+        MPI_Finalize();
+        exit(1);
+    }
+
+    mpiError = MPI_Recv(&granted, 1, MPI_INT, schedulerRank, SCHEDULER_TAG,
+                        MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    if (mpiError != MPI_SUCCESS) {
+        MPI_Finalize();
+        exit(1);
+    }
+}
+
+/** Return this Pipeline's share of the Slice pool to the SliceScheduler.
+ */
+void Pipeline::releaseSlicePool() {
+
+    if (schedulerRank < 0 || !isRoot()) {
+        return;
+    }
 
-    mpiError = MPI_Bcast((void *)procCommand, bufferSize, MPI_CHAR, MPI_ROOT, sliceIntercomm);
+    int msg[3] = { SCHEDULER_RELEASE, 0, 0 };
+
+    mpiError = MPI_Send(msg, 3, MPI_INT, schedulerRank, SCHEDULER_TAG, MPI_COMM_WORLD);
     if (mpiError != MPI_SUCCESS) {
         MPI_Finalize();
         exit(1);
     }
+}
+
+/** Broadcast a Shutdown message to all of the Slices.  Control messages 
+ * still queued are dropped.
+ */
+void Pipeline::invokeShutdown() {
+
+    char procCommand[bufferSize];
+
+    std::strcpy(procCommand, "SHUTDOWN");  
+
+    sendCommand(procCommand, bufferSize, MPI_CHAR);
+
+    /* Collect the reports of cancelled copies that finished too late */
+    int msg[3];
+    while (pendingReports > 0) {
+        mpiError = MPI_Recv(msg, 3, MPI_INT, MPI_ANY_SOURCE, SPECULATION_TAG, harnessComm, 
+                            MPI_STATUS_IGNORE);
+        if (mpiError != MPI_SUCCESS) {
+            MPI_Finalize();
+            exit(1);
+        }
+        pendingReports--;
+    }
 
     return;
 
 }
 
-/** Broadcast a "Continue" message to all of the Slices. 
- * This is used to tell Slices to continue processing (no shutdown event received). 
+/** Begin a visit (no shutdown event received): send the control messages
+ * and the reconfiguration posted since the last visit and, with the visit 
+ * queue on, the work units of this visit and the next; with the visit 
+ * handshake on, broadcast
+ * a "Continue" message to all of the Slices.  Without the handshake the 
+ * Slices learn of a shutdown from the command of the next Stage.
  */
 void Pipeline::invokeContinue() {
 
@@ -188,93 +490,1094 @@ void Pipeline::invokeContinue() {
 
     std::strcpy(procCommand, "CONTINUE");  
 
-    mpiError = MPI_Bcast((void *)procCommand, bufferSize, MPI_CHAR, MPI_ROOT, sliceIntercomm);
+    if (memoryThreshold > 0.0) {
+        waitForMemory();
+    }
+
+    sendControl();
+
+    sendReconfiguration();
+
+    if (visitQueueOn) {
+        startVisit();
+    }
+    else {
+        beginVisitLatency(getWallTime(), 0, 0.0);
+    }
+
+    TraceBuffer::getInstance().record(TRACE_VISIT_BEGIN, rank, 0);
+
+    if (visitHandshake) {
+        sendCommand(procCommand, bufferSize, MPI_CHAR);
+    }
+
+    return;
+}
+
+/** set method for the visit handshake: with it on, each visit starts with
+ * a broadcast that the Slices wait for in Slice::invokeShutdownTest().  
+ * Needed when the Slices wait for an event before the first Stage, as 
+ * they must not block on it once the Pipeline shuts down.
+ */
+void Pipeline::setVisitHandshake(bool handshake) {
+    visitHandshake = handshake;
+}
+
+/** Queue a control message for the Slices: "PAUSE" holds every Slice at 
+ * the end of its current Stage until "RESUME"; "DRAIN" tells them the 
+ * Pipeline ends after the current visit; "LOGLEVEL <threshold>" sets the 
+ * threshold of their logs.  The message is sent by the root at its next 
+ * visit, Stage or poll of waitProcess(), and only when posted on the root.  
+ * May be called from any thread.
+ * @throw lsst::pex::exceptions::InvalidParameterException if the message 
+ *        is not one of these
+ */
+void Pipeline::postControl(const std::string& message) {
+
+    int threshold;
+    char extra;
+    if (message != "PAUSE" && message != "RESUME" && message != "DRAIN" &&
+        std::sscanf(message.c_str(), "LOGLEVEL %d%c", &threshold, &extra) != 1) {
+        throw LSST_EXCEPT(pexExcept::InvalidParameterException, 
+                          "Unknown control message: " + message);
+    }
+
+    boost::mutex::scoped_lock lock(controlMutex);
+    pendingControl.push_back(message);
+    if (message == "DRAIN") {
+        draining = true;
+    }
+}
+
+/** Whether "DRAIN" has been posted with postControl(): the Pipeline should
+ * shut down after the current visit.
+ */
+bool Pipeline::isDraining() {
+    boost::mutex::scoped_lock lock(controlMutex);
+    return draining;
+}
+
+/** set method for the visit queue: each visit takes the next descriptor 
+ * queued with queueVisit(), and the Slices are sent their work units one
+ * visit ahead.  Must be called before startSlices(), which tells the Slices.
+ */
+void Pipeline::setVisitQueue(bool queue) {
+    visitQueueOn = queue;
+}
+
+/** set method for the number of Stages of a visit; the work units of the
+ * next visit are sent ahead as the last of them starts.  If it is not set,
+ * they are sent as the first Stage starts.
+ */
+void Pipeline::setStageCount(int count) {
+    nStages = count;
+}
+
+/** Queue the descriptor of a coming visit.  It holds the descriptor of the
+ * work unit of Slice i as the PropertySet "slice-<i>", whose "files" entry
+ * lists the input files the Slice reads.  A visit for which nothing has 
+ * been queued runs with empty descriptors.  The visit goes ahead of those
+ * queued that are less urgent: an optional "priority" (an int, higher is 
+ * more urgent, 0 by default) comes first, then an optional "deadline" (in
+ * seconds since the epoch, earlier is more urgent), then the order of 
+ * queueing.  A visit whose work units were already sent ahead to the 
+ * Slices, as the last Stage of the previous visit started, keeps its 
+ * place.  May be called from any thread.  Only the queue of the root is 
+ * used: elsewhere the call does nothing.
+ */
+void Pipeline::queueVisit(PropertySet::Ptr visit) {
+
+    if (!isRoot()) {
+        return;
+    }
+
+    QueuedVisit queued;
+    queued.descriptor = visit;
+    queued.priority = visit->exists("priority") ? visit->get<int>("priority") : 0;
+    queued.deadline = visit->exists("deadline") ? visit->get<double>("deadline") : 0.0;
+    queued.queuedAt = getWallTime();
+
+    boost::mutex::scoped_lock lock(visitMutex);
+    std::list<QueuedVisit>::iterator iter = visitQueue.begin();
+    if (lookaheadSent && iter != visitQueue.end()) {
+        iter++;
+    }
+    while (iter != visitQueue.end() && !isMoreUrgent(queued, *iter)) {
+        iter++;
+    }
+    visitQueue.insert(iter, queued);
+}
+
+/** Whether a visit is to be dispatched before another: it has the higher
+ * priority or, at the same priority, the earlier deadline.
+ */
+bool Pipeline::isMoreUrgent(const QueuedVisit& visit, const QueuedVisit& other) {
+    if (visit.priority != other.priority) {
+        return visit.priority > other.priority;
+    }
+    if (visit.deadline <= 0.0) {
+        return false;
+    }
+    return other.deadline <= 0.0 || visit.deadline < other.deadline;
+}
+
+/** get the descriptor of the current visit; an empty PropertySet if none
+ * was queued for it
+ */
+PropertySet::Ptr Pipeline::getVisit() {
+    boost::mutex::scoped_lock lock(visitMutex);
+    if (!currentVisit) {
+        return PropertySet::Ptr(new PropertySet);
+    }
+    return currentVisit;
+}
+
+/** Take the descriptor of the visit that begins from the queue of the 
+ * root, which broadcasts it to the other Pipeline ranks, and send the
+ * Slices their work units for it unless they were sent during the last
+ * Stage of the previous visit.
+ */
+void Pipeline::startVisit() {
+
+    visitCount++;
+
+    QueuedVisit visit;
+    visit.priority = 0;
+    visit.deadline = 0.0;
+    visit.queuedAt = getWallTime();
+    bool sent = false;
+    if (isRoot()) {
+        boost::mutex::scoped_lock lock(visitMutex);
+        sent = lookaheadSent;
+        lookaheadSent = false;
+        if (!visitQueue.empty()) {
+            visit = visitQueue.front();
+            visitQueue.pop_front();
+        }
+    }
+    if (!visit.descriptor) {
+        visit.descriptor.reset(new PropertySet);
+    }
+
+    if (pipelineSize > 1) {
+        double urgency[2] = { visit.deadline, visit.queuedAt };
+        mpiError = MPI_Bcast(&visit.priority, 1, MPI_INT, 0, pipelineComm);
+        if (mpiError != MPI_SUCCESS) {
+            MPI_Finalize();
+            exit(1);
+        }
+        mpiError = MPI_Bcast(urgency, 2, MPI_DOUBLE, 0, pipelineComm);
+        if (mpiError != MPI_SUCCESS) {
+            MPI_Finalize();
+            exit(1);
+        }
+        visit.deadline = urgency[0];
+        visit.queuedAt = urgency[1];
+
+        boost::mpi::communicator pipelineWorld(pipelineComm, boost::mpi::comm_attach);
+        boost::mpi::broadcast(pipelineWorld, visit.descriptor, 0);
+    }
+
+    {
+        boost::mutex::scoped_lock lock(visitMutex);
+        currentVisit = visit.descriptor;
+    }
+
+    beginVisitLatency(visit.queuedAt, visit.priority, visit.deadline);
+
+    if (!sent) {
+        sendVisit(visitCount, visit.descriptor);
+    }
+}
+
+/** Send the Slices their work units for the next visit if it has been 
+ * queued and they have not been sent yet.  Called as the last Stage of a
+ * visit starts, so that a more urgent visit queued until then still goes
+ * next.
+ */
+void Pipeline::sendLookahead() {
+
+    PropertySet::Ptr next;
+    {
+        boost::mutex::scoped_lock lock(visitMutex);
+        if (lookaheadSent || visitQueue.empty()) {
+            return;
+        }
+        next = visitQueue.front().descriptor;
+        lookaheadSent = true;
+    }
+    sendVisit(visitCount + 1, next);
+}
+
+/** Start the latency of the visit that begins, from the time it was 
+ * queued, warning if it is dispatched past its deadline.
+ */
+void Pipeline::beginVisitLatency(double queuedAt, int priority, double deadline) {
+
+    double now = getWallTime();
+    visitPriority = priority;
+    visitDeadline = deadline;
+    visitQueuedAt = queuedAt;
+
+    if (!isRoot()) {
+        return;
+    }
+
+    PropertySet::Ptr latency(new PropertySet);
+    latency->set<int>("priority", priority);
+    if (deadline > 0.0) {
+        latency->set<double>("deadline", deadline);
+    }
+    latency->set<double>("queueWait", now - queuedAt);
+    visitLatency = latency;
+
+    if (deadline > 0.0 && now > deadline) {
+        Log log(_logutils.getLogger(), "beginVisitLatency.cpp");
+        log.log(Log::WARN, boost::format("Dispatching a visit of priority %d %.1f s past its deadline")
+                % priority % (now - deadline));
+    }
+}
+
+/** Record when the Stage ended, since the visit was queued, with the 
+ * longest a Slice waited for its command and took to process it.
+ */
+void Pipeline::recordLatency(int iStage //!< The integer index of the current Stage
+                             ) {
+
+    if (!isRoot() || !visitLatency) {
+        return;
+    }
+
+    double now = getWallTime();
+    const ReportLoc* report = slicesReport;
+
+    PropertySet::Ptr stage(new PropertySet);
+    stage->set<double>("dispatched", stageDispatchedAt - visitQueuedAt);
+    stage->set<double>("completed", now - visitQueuedAt);
+    if (visitDeadline > 0.0) {
+        stage->set<double>("slack", visitDeadline - now);
+    }
+    if (report[REPORT_PROCESS_TIME].rank >= 0) {
+        stage->set<double>("sliceWait", report[REPORT_COMMAND_WAIT].value);
+        stage->set<int>("sliceWaitSlice", report[REPORT_COMMAND_WAIT].rank);
+        stage->set<double>("sliceProcess", report[REPORT_PROCESS_TIME].value);
+        stage->set<int>("sliceProcessSlice", report[REPORT_PROCESS_TIME].rank);
+    }
+
+    std::ostringstream key;
+    key << "stage-" << iStage;
+    visitLatency->set<PropertySet::Ptr>(key.str(), stage);
+}
+
+/** get the latency of the current visit: its "priority" and "deadline", 
+ * the seconds it waited in the queue ("queueWait"), and for each Stage 
+ * done so far the PropertySet "stage-<i>" with the seconds from queueing 
+ * to the command of the Stage ("dispatched") and to its end ("completed"),
+ * the seconds left before the deadline at its end ("slack"), and the 
+ * longest a Slice waited for the command ("sliceWait") and took to process 
+ * the Stage ("sliceProcess"), each with that Slice ("sliceWaitSlice", 
+ * "sliceProcessSlice").  A visit not taken from the queue counts from the
+ * start of the visit.
+ * @return the latency on the root; an empty PropertySet on other ranks
+ */
+PropertySet::Ptr Pipeline::getVisitLatency() {
+    if (!visitLatency) {
+        return PropertySet::Ptr(new PropertySet);
+    }
+    return visitLatency->deepCopy();
+}
+
+/** Send each Slice its work unit for a visit, from the root.  The sends 
+ * are not waited for, as a Slice only takes in its work units between 
+ * Stages.
+ */
+void Pipeline::sendVisit(int visit, PropertySet::Ptr descriptor) {
+
+    if (!isRoot()) {
+        return;
+    }
+
+    completeVisitSends(false);
+
+    boost::mpi::communicator sliceWorld(sliceIntercomm, boost::mpi::comm_attach);
+
+    for (int i = 0; i < nSlices; i++) {
+        std::ostringstream key;
+        key << "slice-" << i;
+
+        PropertySet::Ptr unit;
+        if (descriptor->exists(key.str())) {
+            unit = descriptor->get<PropertySet::Ptr>(key.str())->deepCopy();
+        }
+        else {
+            unit.reset(new PropertySet);
+        }
+        unit->set<int>("visit", visit);
+
+        boost::shared_ptr<boost::mpi::packed_oarchive> archive(
+            new boost::mpi::packed_oarchive(sliceWorld));
+        *archive << unit;
+
+        MPI_Request request;
+        mpiError = MPI_Isend(const_cast<void*>(archive->address()), archive->size(), MPI_PACKED, 
+                             i, VISIT_PREFETCH_TAG, sliceIntercomm, &request);
+        if (mpiError != MPI_SUCCESS) {
+            MPI_Finalize();
+            exit(1);
+        }
+        visitRequests.push_back(request);
+        visitArchives.push_back(archive);
+    }
+}
+
+/** Release the work units whose sends have completed.
+ * @param wait   whether to wait for all of them
+ */
+void Pipeline::completeVisitSends(bool wait) {
+
+    unsigned int i = 0;
+    while (i < visitRequests.size()) {
+        int flag = 1;
+        if (wait) {
+            mpiError = MPI_Wait(&visitRequests[i], MPI_STATUS_IGNORE);
+        }
+        else {
+            mpiError = MPI_Test(&visitRequests[i], &flag, MPI_STATUS_IGNORE);
+        }
+        if (mpiError != MPI_SUCCESS) {
+            MPI_Finalize();
+            exit(1);
+        }
+        if (flag) {
+            visitRequests.erase(visitRequests.begin() + i);
+            visitArchives.erase(visitArchives.begin() + i);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+/** Post changes to the configuration of the Slices, applied at the start
+ * of the next visit.  The delta may hold "logThreshold", the new threshold
+ * of the logs; "topology", a PropertySet with the "type", "param1" and 
+ * "param2" of a new Slice topology; and "stage-<i>", a PropertySet of 
+ * parameters to set in the policy of Stage i.  Deltas posted before the
+ * next visit are merged, the later taking precedence: Stage parameters
+ * leaf by leaf, the rest as a whole.  Only the deltas 
+ * posted on the root are applied.  May be called from any thread.
+ * @throw lsst::pex::exceptions::InvalidParameterException if the delta 
+ *        holds anything else
+ */
+void Pipeline::postReconfiguration(PropertySet::Ptr delta) {
+
+    std::vector<std::string> names = delta->names(true);
+    for (unsigned int i = 0; i < names.size(); i++) {
+        bool valid;
+        if (names[i] == "logThreshold") {
+            valid = !delta->isPropertySetPtr(names[i]);
+        }
+        else if (names[i] == "topology") {
+            valid = delta->isPropertySetPtr(names[i]) && 
+                    delta->get<PropertySet::Ptr>(names[i])->exists("type");
+        }
+        else {
+            int iStage;
+            char extra;
+            valid = std::sscanf(names[i].c_str(), "stage-%d%c", &iStage, &extra) == 1 &&
+                    delta->isPropertySetPtr(names[i]);
+        }
+        if (!valid) {
+            throw LSST_EXCEPT(pexExcept::InvalidParameterException, 
+                              "Cannot reconfigure the Slices with: " + names[i]);
+        }
+    }
+
+    PropertySet::Ptr copy = delta->deepCopy();
+    boost::mutex::scoped_lock lock(controlMutex);
+    if (!pendingReconfiguration) {
+        pendingReconfiguration = copy;
+        return;
+    }
+
+    /* Stage parameters merge leaf by leaf, so that nested parameters posted
+       earlier survive; the log threshold and the topology are replaced */
+    for (unsigned int i = 0; i < names.size(); i++) {
+        if (names[i].compare(0, 6, "stage-") == 0 && pendingReconfiguration->exists(names[i])) {
+            PropertySet::Ptr stage = pendingReconfiguration->get<PropertySet::Ptr>(names[i]);
+            PropertySet::Ptr changes = copy->get<PropertySet::Ptr>(names[i]);
+            std::vector<std::string> parameters = changes->paramNames(false);
+            for (unsigned int j = 0; j < parameters.size(); j++) {
+                stage->copy(parameters[j], changes, parameters[j]);
+            }
+        }
+        else {
+            pendingReconfiguration->copy(names[i], copy, names[i]);
+        }
+    }
+}
+
+/** get the reconfiguration applied at the start of the current visit, for
+ * the serial part of the Stages, and forget it; an empty PropertySet if 
+ * there was none
+ */
+PropertySet::Ptr Pipeline::takeReconfiguration() {
+    PropertySet::Ptr delta = currentReconfiguration;
+    currentReconfiguration.reset();
+    if (!delta) {
+        return PropertySet::Ptr(new PropertySet);
+    }
+    return delta;
+}
+
+/** Broadcast the posted reconfiguration, if any, to the other Pipeline 
+ * ranks and to the Slices as the command "RECONFIGURE" followed by the 
+ * packed delta.  The root decides for all Pipeline ranks.
+ */
+void Pipeline::sendReconfiguration() {
+
+    PropertySet::Ptr delta;
+    if (isRoot()) {
+        boost::mutex::scoped_lock lock(controlMutex);
+        delta.swap(pendingReconfiguration);
+    }
+
+    int pending = delta ? 1 : 0;
+    mpiError = MPI_Bcast(&pending, 1, MPI_INT, 0, pipelineComm);
     if (mpiError != MPI_SUCCESS) {
         MPI_Finalize();
         exit(1);
     }
+    if (!pending) {
+        return;
+    }
 
-    return;
+    boost::mpi::communicator pipelineWorld(pipelineComm, boost::mpi::comm_attach);
+    boost::mpi::broadcast(pipelineWorld, delta, 0);
+
+    char procCommand[bufferSize];
+    std::strcpy(procCommand, "RECONFIGURE");
+    sendCommand(procCommand, bufferSize, MPI_CHAR);
+
+    boost::mpi::packed_oarchive archive(pipelineWorld);
+    archive << delta;
+    int size = archive.size();
+    sendCommand(&size, 1, MPI_INT);
+    sendCommand(const_cast<void*>(archive.address()), size, MPI_PACKED);
+
+    currentReconfiguration = delta;
+
+    Log log(_logutils.getLogger(), "sendReconfiguration.cpp");
+    log.log(Log::INFO, boost::format("Reconfiguring the Slices: %s") % delta->toString());
+}
+
+/** Send the queued control messages to every Slice, from the root.
+ */
+void Pipeline::sendControl() {
+
+    std::list<std::string> messages;
+    {
+        boost::mutex::scoped_lock lock(controlMutex);
+        messages.swap(pendingControl);
+    }
+    if (!isRoot()) {
+        return;
+    }
+
+    char buffer[CONTROL_MESSAGE_SIZE];
+    std::list<std::string>::iterator iter;
+    for (iter = messages.begin(); iter != messages.end(); iter++) {
+        std::memset(buffer, 0, CONTROL_MESSAGE_SIZE);
+        std::strncpy(buffer, iter->c_str(), CONTROL_MESSAGE_SIZE - 1);
+        for (int i = 0; i < nSlices; i++) {
+            mpiError = MPI_Send(buffer, CONTROL_MESSAGE_SIZE, MPI_CHAR, i, CONTROL_MESSAGE_TAG, 
+                                sliceIntercomm);
+            if (mpiError != MPI_SUCCESS) {
+                MPI_Finalize();
+                exit(1);
+            }
+        }
+        if (*iter == "PAUSE") {
+            slicesPaused = true;
+        }
+        else if (*iter == "RESUME") {
+            slicesPaused = false;
+        }
+    }
+}
+
+/** Hold back the next visit while the node of some Slice has more than 
+ * memoryThreshold of its memory in use, polling the Slices once a second, 
+ * until memoryWaitLimit has passed.  The root decides for all Pipeline ranks.
+ */
+void Pipeline::waitForMemory() {
+
+    Log log(_logutils.getLogger(), "waitForMemory.cpp");
+    boost::posix_time::milliseconds pause(1000);
+    double start = MPI_Wtime();
+    bool held = false;
+
+    char procCommand[bufferSize];
+    std::strcpy(procCommand, "MEMORY");
+
+    while (true) {
+        sendCommand(procCommand, bufferSize, MPI_CHAR);
+
+        controlBarrier();
+        const ReportLoc* report = slicesReport;
+
+        int hold = 0;
+        if (isRoot() && report[REPORT_NODE_USED].value > memoryThreshold) {
+            if (memoryWaitLimit > 0.0 && MPI_Wtime() - start >= memoryWaitLimit) {
+                log.log(Log::WARN, 
+                    boost::format("Dispatching visit after %.0f s with %.1f%% of the memory of the node of Slice %d in use")
+                    % (MPI_Wtime() - start) % (100.0 * report[REPORT_NODE_USED].value) 
+                    % report[REPORT_NODE_USED].rank);
+            }
+            else {
+                if (!held) {
+                    log.log(Log::WARN, 
+                        boost::format("Holding back visit: %.1f%% of the memory of the node of Slice %d in use, threshold %.1f%%")
+                        % (100.0 * report[REPORT_NODE_USED].value) % report[REPORT_NODE_USED].rank 
+                        % (100.0 * memoryThreshold));
+                }
+                hold = 1;
+            }
+        }
+
+        mpiError = MPI_Bcast(&hold, 1, MPI_INT, 0, pipelineComm);
+        if (mpiError != MPI_SUCCESS) {
+            MPI_Finalize();
+            exit(1);
+        }
+        if (!hold) {
+            break;
+        }
+        held = true;
+        boost::this_thread::sleep(pause);
+    }
+
+    if (held && isRoot()) {
+        log.log(Log::INFO, boost::format("Visit held back for %.1f s") % (MPI_Wtime() - start));
+    }
+}
+
+/** Fold the memory reports that ended a Stage into the memory use kept 
+ * for the Stage.
+ */
+void Pipeline::recordMemory(int iStage //!< The integer index of the current Stage
+                            ) {
+
+    if (!isRoot()) {
+        return;
+    }
+
+    const ReportLoc* report = slicesReport;
+
+    PropertySet::Ptr& ps = stageMemory[iStage];
+    if (!ps) {
+        ps.reset(new PropertySet);
+        ps->set<int>("stage", iStage);
+        ps->set<double>("maxRss", 0.0);
+        ps->set<double>("maxPeakRss", 0.0);
+        ps->set<double>("maxNodeUsed", 0.0);
+    }
+
+    ps->set<double>("rssBegin", report[REPORT_RSS_BEGIN].value);
+    ps->set<int>("rssBeginSlice", report[REPORT_RSS_BEGIN].rank);
+    ps->set<double>("rss", report[REPORT_RSS_END].value);
+    ps->set<int>("rssSlice", report[REPORT_RSS_END].rank);
+    ps->set<double>("peakRss", report[REPORT_PEAK_RSS].value);
+    ps->set<int>("peakRssSlice", report[REPORT_PEAK_RSS].rank);
+    ps->set<double>("nodeUsed", report[REPORT_NODE_USED].value);
+    ps->set<int>("nodeUsedSlice", report[REPORT_NODE_USED].rank);
+
+    ps->set<double>("maxRss", std::max(ps->get<double>("maxRss"), report[REPORT_RSS_END].value));
+    ps->set<double>("maxPeakRss", std::max(ps->get<double>("maxPeakRss"), report[REPORT_PEAK_RSS].value));
+    ps->set<double>("maxNodeUsed", std::max(ps->get<double>("maxNodeUsed"), report[REPORT_NODE_USED].value));
+}
+
+/** get the memory use of the Slices in a Stage: the largest resident size 
+ * in MB at its start ("rssBegin") and end ("rss"), the largest peak resident
+ * size ("peakRss") and the largest fraction of the memory of a node in use
+ * ("nodeUsed") in the last visit, each with the Slice it was seen on
+ * ("rssSlice", ...), and their high-water marks over all visits ("maxRss",
+ * "maxPeakRss", "maxNodeUsed").
+ * @return the memory use on the root; an empty PropertySet on other ranks,
+ *         or if the Stage has not been accounted
+ */
+PropertySet::Ptr Pipeline::getMemoryUsage(int iStage) {
+    std::map<int, PropertySet::Ptr>::iterator iter = stageMemory.find(iStage);
+    if (iter == stageMemory.end()) {
+        return PropertySet::Ptr(new PropertySet);
+    }
+    return iter->second->deepCopy();
 }
 
 /** Tell the Slices to perform the interSlice communication, i.e., synchronized the Slices.
+ * When the Slice pool is shared, the exchange waits for the cores like a Stage.
  */
 void Pipeline::invokeSyncSlices() {
 
 
-    Log log(_logutils.getLogger(), "invokeSyncSlices.cpp");
-    
-    log.log(Log::INFO,
-        boost::format("Start invokeSyncSlices: rank %d ") % rank);
-
-    log.log(Log::INFO,
-        boost::format("InterSlice Communication Command Bcast rank %d ") % rank);
+    TraceBuffer& trace = TraceBuffer::getInstance();
+    trace.record(TRACE_SYNC_BEGIN, rank, 0);
 
     char procCommand[bufferSize];
     std::strcpy(procCommand, "SYNC");  
 
-    mpiError = MPI_Bcast((void *)procCommand, bufferSize, MPI_CHAR, MPI_ROOT, sliceIntercomm);
-    if (mpiError != MPI_SUCCESS) {
-        MPI_Finalize();
-        exit(1);
+    acquireSlicePool();
+
+    sendCommand(procCommand, bufferSize, MPI_CHAR);
+
+    trace.record(TRACE_SYNC_POSTED, rank, 0);
+
+    controlBarrier();
+
+    releaseSlicePool();
+
+    trace.record(TRACE_SYNC_END, rank, 0);
+}
+
+/** Tell the Slices to call the process method for the current Stage and 
+ * wait until they are done; the same as startProcess() followed by 
+ * waitProcess() without a timeout.
+ */
+void Pipeline::invokeProcess(int iStage) {
+    startProcess(iStage);
+    waitProcess(-1.0);
+}
+
+/** Tell the Slices to call the process method for the current Stage, 
+ * without waiting for them; waitProcess() ends the Stage.
+ * When the Slice pool is shared, the Stage only starts once the
+ * SliceScheduler has granted it the cores.
+ * @throw lsst::pex::exceptions::LogicErrorException if the previous Stage 
+ *        has not ended
+ */
+void Pipeline::startProcess(int iStage) {
+
+    if (processStage != 0) {
+        throw LSST_EXCEPT(pexExcept::LogicErrorException, 
+                          "startProcess() called before the previous Stage ended");
     }
 
-    log.log(Log::INFO,
-        boost::format("End Bcast rank %d ") % rank);
+    char procCommand[bufferSize];
+
+    bool speculative = (nSlices > 1 && speculativeStages.count(iStage) > 0);
+    if (speculative) {
+        speculationSequence++;
+        std::sprintf(procCommand, "SPECULATE %d", speculationSequence);
+    }
+    else {
+        std::strcpy(procCommand, "PROCESS");  
+    }
+
+    acquireSlicePool();
+
+    sendControl();
+
+    if (visitQueueOn && iStage >= nStages) {
+        sendLookahead();
+    }
+
+    TraceBuffer::getInstance().record(TRACE_PROCESS_BEGIN, rank, iStage, nSlices);
+
+    stageDispatchedAt = getWallTime();
+    sendCommand(procCommand, bufferSize, MPI_CHAR);
+
+    sendCommand(&iStage, 1, MPI_INT);
+
+    processStage = iStage;
+    processSpeculative = speculative;
+    startReports(!speculative);
+}
+
+/** Wait for the Slices to finish the Stage started by startProcess().  
+ * Given a timeout, the root polls for the reports of the node leaders, and
+ * the other Pipeline ranks for the word of the root, so that the caller 
+ * gets control back while the Slices are still busy.  A speculative Stage
+ * is followed to its end by the root before it returns.
+ * @param timeout   the longest time in seconds to wait; negative waits for 
+ *                  as long as the Stage runs
+ * @return whether the Stage has ended; if not, call waitProcess() again
+ * @throw lsst::pex::exceptions::LogicErrorException if no Stage was started
+ */
+bool Pipeline::waitProcess(double timeout) {
+
+    if (processStage == 0) {
+        throw LSST_EXCEPT(pexExcept::LogicErrorException, 
+                          "waitProcess() called without startProcess()");
+    }
+
+    if (processSpeculative && isRoot()) {
+        trackWorkUnits(processStage);
+        notifyPipelineRanks();
+    }
+
+    if (!receiveReports(timeout)) {
+        return false;
+    }
 
-    mpiError = MPI_Barrier(sliceIntercomm);
+    int iStage = processStage;
+    processStage = 0;
+
+    if (memoryAccounting && !processSpeculative) {
+        recordMemory(iStage);
+    }
+    recordLatency(iStage);
+
+    TraceBuffer::getInstance().record(TRACE_PROCESS_END, rank, iStage, nSlices);
+
+    releaseSlicePool();
+
+    return true;
+}
+
+/** Follow the work units of a speculative Stage until each has been done 
+ * once.  Work unit i starts on Slice i.  A Slice that reports its work unit
+ * done becomes idle; once speculationThreshold of the work units are done,
+ * an idle Slice is handed a copy of a work unit that has run more than 
+ * speculationFactor times the median time.  Whichever copy finishes first 
+ * wins and the Slice running the other is told to cancel it.
+ */
+void Pipeline::trackWorkUnits(int iStage) {
+
+    TraceBuffer& trace = TraceBuffer::getInstance();
+
+    std::vector<int> copies(nSlices, 1);
+    std::vector<int> running(nSlices);
+    std::vector<bool> done(nSlices, false);
+    std::vector<double> durations;
+    std::vector<int> idle;
+    for (int i = 0; i < nSlices; i++) {
+        running[i] = i;
+    }
+
+    double start = MPI_Wtime();
+    boost::posix_time::microseconds pause(1000);
+
+    int msg[3];
+    MPI_Request request;
+    MPI_Status status;
+    int flag;
+
+    mpiError = MPI_Irecv(msg, 3, MPI_INT, MPI_ANY_SOURCE, SPECULATION_TAG, harnessComm, &request);
     if (mpiError != MPI_SUCCESS) {
         MPI_Finalize();
         exit(1);
     }
 
-    log.log(Log::INFO,
-        boost::format("End invokeSyncSlices rank %d ") % rank);
+    while (static_cast<int>(durations.size()) < nSlices) {
+
+        mpiError = MPI_Test(&request, &flag, &status);
+        if (mpiError != MPI_SUCCESS) {
+            MPI_Finalize();
+            exit(1);
+        }
+
+        if (!flag) {
+            int unit = -1;
+            if (!idle.empty()) {
+                unit = findStraggler(copies, done, durations, MPI_Wtime() - start);
+            }
+            if (unit < 0) {
+                boost::this_thread::sleep(pause);
+                continue;
+            }
+
+            int slice = idle.back();
+            idle.pop_back();
+            running[slice] = unit;
+            copies[unit]++;
+            sendSpeculation(slice, unit, SPECULATION_RUN);
+            trace.record(TRACE_SPECULATE_RUN, rank, iStage, unit, slice);
+
+            Log log(_logutils.getLogger(), "trackWorkUnits.cpp");
+            log.log(Log::INFO, boost::format("Stage %d: re-executing work unit %d on Slice %d") 
+                    % iStage % unit % slice);
+            continue;
+        }
+
+        /* Late reports of copies cancelled in an earlier speculative Stage */
+        if (msg[0] != speculationSequence) {
+            pendingReports--;
+        }
+        else {
+            int slice = status.MPI_SOURCE - pipelineSize;
+            int unit = msg[1];
+
+            if (msg[2] == SPECULATION_DONE && !done[unit]) {
+                done[unit] = true;
+                durations.push_back(MPI_Wtime() - start);
+                for (int i = 0; i < nSlices; i++) {
+                    if (i != slice && running[i] == unit) {
+                        sendSpeculation(i, unit, SPECULATION_CANCEL);
+                        trace.record(TRACE_SPECULATE_CANCEL, rank, iStage, unit, i);
+                    }
+                }
+            }
+            copies[unit]--;
+            running[slice] = -1;
+            idle.push_back(slice);
+        }
+
+        mpiError = MPI_Irecv(msg, 3, MPI_INT, MPI_ANY_SOURCE, SPECULATION_TAG, harnessComm, &request);
+        if (mpiError != MPI_SUCCESS) {
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+
+    MPI_Cancel(&request);
+    MPI_Wait(&request, MPI_STATUS_IGNORE);
+
+    /* Slices still finishing a cancelled copy pick this up when done; 
+       their reports are collected later */
+    for (int i = 0; i < nSlices; i++) {
+        sendSpeculation(i, -1, SPECULATION_END);
+        if (running[i] >= 0) {
+            pendingReports++;
+        }
+    }
 }
 
-/** Tell the Slices to call the process method for the current Stage.
+/** Pick a work unit to re-execute: the lowest numbered one that is not 
+ * done, has a single copy running and has run too long.
+ * @return the work unit, or -1 if there is none
  */
-void Pipeline::invokeProcess(int iStage) {
-
-    Log log(_logutils.getLogger(), "invokeProcess.cpp");
+int Pipeline::findStraggler(const std::vector<int>& copies, const std::vector<bool>& done, 
+                            const std::vector<double>& durations, double elapsed) {
 
+    if (durations.empty() || durations.size() < speculationThreshold * nSlices) {
+        return -1;
+    }
 
-    char processCommand[nSlices][bufferSize];
-    for (int k = 0 ; k < nSlices; k++) {
-        std::strcpy(processCommand[k], "PROCESS");
+    std::vector<double> sorted(durations);
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
+    if (elapsed < speculationFactor * sorted[sorted.size()/2]) {
+        return -1;
     }
 
-    char procCommand[bufferSize];
+    for (int i = 0; i < nSlices; i++) {
+        if (!done[i] && copies[i] == 1) {
+            return i;
+        }
+    }
+    return -1;
+}
 
-    std::strcpy(procCommand, "PROCESS");  
+/** Send a speculation message for the current speculative Stage to a Slice.
+ */
+void Pipeline::sendSpeculation(int slice, int unit, int op) {
 
-    mpiError = MPI_Bcast((void *)procCommand, bufferSize, MPI_CHAR, MPI_ROOT, sliceIntercomm);
+    int msg[3] = { speculationSequence, unit, op };
+    mpiError = MPI_Send(msg, 3, MPI_INT, pipelineSize + slice, SPECULATION_TAG, harnessComm);
     if (mpiError != MPI_SUCCESS) {
         MPI_Finalize();
         exit(1);
     }
+}
 
+/** Broadcast a command to the node-leader Slices, which relay it to the 
+ * Slices on their nodes.  When the Slice pool is shared, the root first 
+ * wakes each leader with an empty message.
+ */
+void Pipeline::sendCommand(void* buffer, int count, MPI_Datatype datatype) {
+
+    if (schedulerRank >= 0 && isRoot()) {
+        for (int i = 0; i < nLeaders; i++) {
+            mpiError = MPI_Send(NULL, 0, MPI_BYTE, i, CONTROL_WAKE_TAG, controlIntercomm);
+            if (mpiError != MPI_SUCCESS) {
+                MPI_Finalize();
+                exit(1);
+            }
+        }
+    }
 
-    mpiError = MPI_Bcast(&iStage, 1, MPI_INT, MPI_ROOT, sliceIntercomm);
+    int root = isRoot() ? MPI_ROOT : MPI_PROC_NULL;
+    mpiError = MPI_Bcast(buffer, count, datatype, root, controlIntercomm);
     if (mpiError != MPI_SUCCESS) {
         MPI_Finalize();
         exit(1);
     }
+}
 
+/** Wait until every Slice has reached the matching controlBarrier(): each
+ * node leader reports once all Slices on its node have.  The root passes 
+ * the word on to the other Pipeline ranks.
+ */
+void Pipeline::controlBarrier() {
+    startReports(true);
+    receiveReports(-1.0);
+}
+
+/** Expect the reports that end a wait on the Slices: one from each node 
+ * leader on the root, or none if the Slices do not report (speculative 
+ * Stages), and one from the root on the other Pipeline ranks.
+ */
+void Pipeline::startReports(bool fromSlices) {
+
+    pendingDone = isRoot() ? (fromSlices ? nLeaders : 0) : 1;
+    for (int i = 0; i < REPORT_FIELDS; i++) {
+        slicesReport[i].value = -1.0;
+        slicesReport[i].rank = -1;
+    }
+}
+
+/** Receive the outstanding reports expected by startReports().  The root 
+ * keeps the largest value of each field of the Stage reports, and tells 
+ * the other Pipeline ranks once the last report is in.
+ * @param timeout   the longest time in seconds to wait; negative blocks
+ *                  until all reports are in
+ * @return whether all reports are in
+ */
+bool Pipeline::receiveReports(double timeout) {
+
+    MPI_Comm comm = isRoot() ? controlIntercomm : pipelineComm;
+    int source = isRoot() ? MPI_ANY_SOURCE : 0;
+    int count = isRoot() ? REPORT_FIELDS : 0;
+    double start = MPI_Wtime();
+    long pause = 50;
+
+    while (pendingDone > 0) {
+
+        /* Paused Slices only report once "RESUME" has been sent */
+        int flag = 1;
+        if (timeout >= 0.0 || slicesPaused) {
+            mpiError = MPI_Iprobe(source, CONTROL_DONE_TAG, comm, &flag, MPI_STATUS_IGNORE);
+            if (mpiError != MPI_SUCCESS) {
+                MPI_Finalize();
+                exit(1);
+            }
+        }
+        if (!flag) {
+            sendControl();
+            double left = timeout - (MPI_Wtime() - start);
+            if (timeout >= 0.0 && left <= 0.0) {
+                return false;
+            }
+            /* Back off, as the Slices may be busy for a long time */
+            long sleep = pause;
+            if (timeout >= 0.0 && sleep > left * 1.0e6) {
+                sleep = static_cast<long>(left * 1.0e6) + 1;
+            }
+            boost::this_thread::sleep(boost::posix_time::microseconds(sleep));
+            if (pause < 10000) {
+                pause *= 2;
+            }
+            continue;
+        }
+        pause = 50;
+
+        ReportLoc report[REPORT_FIELDS];
+        mpiError = MPI_Recv(report, count, MPI_DOUBLE_INT, source, CONTROL_DONE_TAG, comm, 
+                            MPI_STATUS_IGNORE);
+        if (mpiError != MPI_SUCCESS) {
+            MPI_Finalize();
+            exit(1);
+        }
+        for (int i = 0; i < count; i++) {
+            if (report[i].value > slicesReport[i].value) {
+                slicesReport[i] = report[i];
+            }
+        }
+
+        pendingDone--;
+        if (pendingDone == 0 && isRoot()) {
+            notifyPipelineRanks();
+        }
+    }
+
+    return true;
+}
 
-    mpiError = MPI_Barrier(sliceIntercomm);
+/** Tell the other Pipeline ranks that the Slices are done.
+ */
+void Pipeline::notifyPipelineRanks() {
+
+    for (int i = 1; i < pipelineSize; i++) {
+        mpiError = MPI_Send(NULL, 0, MPI_DOUBLE_INT, i, CONTROL_DONE_TAG, pipelineComm);
+        if (mpiError != MPI_SUCCESS) {
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+}
+
+/** Gather the results of the serial work of each Pipeline rank at the 
+ * root.  Collective over the Pipeline ranks.
+ * @return on the root, a PropertySet holding the PropertySet of each rank
+ *         keyed by "shard-<rank>"; an empty PropertySet on the other ranks
+ */
+PropertySet::Ptr Pipeline::gatherShards(PropertySet::Ptr ps //!< A smart pointer to the results of this rank
+                                       ) {
+
+    boost::mpi::communicator pipelineWorld(pipelineComm, boost::mpi::comm_attach);
+
+    std::vector<PropertySet::Ptr> shards;
+    if (isRoot()) {
+        boost::mpi::gather(pipelineWorld, ps, shards, 0);
+    }
+    else {
+        boost::mpi::gather(pipelineWorld, ps, 0);
+    }
+
+    PropertySet::Ptr result(new PropertySet);
+    for (unsigned int i = 0; i < shards.size(); i++) {
+        std::ostringstream newkey;
+        newkey << "shard-" << i;
+        result->set<PropertySet::Ptr>(newkey.str(), shards[i]);
+    }
+    return result;
+}
+
+/** Make the Pipeline ranks agree on whether to shut down: each may see a 
+ * shutdown event at a different time, so the root decides for all of them.
+ * Collective over the Pipeline ranks.
+ * @return whether the root wants to shut down
+ */
+bool Pipeline::agreeOnShutdown(bool stop) {
+
+    int flag = stop ? 1 : 0;
+    mpiError = MPI_Bcast(&flag, 1, MPI_INT, 0, pipelineComm);
     if (mpiError != MPI_SUCCESS) {
         MPI_Finalize();
         exit(1);
     }
+    return flag != 0;
+}
 
-    return;
+/** Write the hot-path TraceBuffer of the Pipeline to a file.
+ */
+void Pipeline::dumpTrace(const std::string& filename) {
+    TraceBuffer::getInstance().dump(filename);
+}
+
+/** Release the control tree and disconnect from the Slices before 
+ * MPI_Finalize, so that no process finalizes while another still holds 
+ * a connection to it.
+ */
+void Pipeline::disconnect() {
+    /* The Slices take in the work units still on their way as they disconnect */
+    completeVisitSends(true);
+    MPI_Comm_free(&controlIntercomm);
+    MPI_Comm_free(&harnessComm);
+    MPI_Comm_disconnect(&sliceIntercomm);
 }
 
 /** Shutdown the Pipeline by calling MPI_Finalize and then exit().
+ * A SliceScheduler is told first so that it can retire this Pipeline.
  */
 void Pipeline::shutdown() {
 
+    if (schedulerRank >= 0 && isRoot()) {
+        int msg[3] = { SCHEDULER_DONE, 0, 0 };
+        MPI_Send(msg, 3, MPI_INT, schedulerRank, SCHEDULER_TAG, MPI_COMM_WORLD);
+    }
+
+    disconnect();
+
     MPI_Finalize(); 
     exit(0);
 
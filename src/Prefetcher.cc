@@ -0,0 +1,273 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsst.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file Prefetcher.cc
+  *
+  * \ingroup mpiharness
+  *
+  * \brief   Prefetcher reads the input files of upcoming visits of a Slice
+  *          into memory on a background thread.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#include <exception>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boost/bind.hpp>
+
+#include "lsst/pex/mpiharness/Prefetcher.h"
+
+using lsst::daf::base::PropertySet;
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/**
+ * Constructor.  Starts the thread that stages the files.
+ * @param capacity   the most bytes of files to keep mapped at once
+ */
+Prefetcher::Prefetcher(long long capacity)
+    : _capacity(capacity), _used(0), _currentVisit(0), _stopping(false),
+      _thread(boost::bind(&Prefetcher::run, this))
+{ }
+
+/** Destructor.
+ */
+Prefetcher::~Prefetcher(void) {
+    stop();
+}
+
+/** Queue the work unit descriptor of a visit for staging.  Returns
+ * immediately.
+ * @param visit   the number of the visit, counted from 1
+ * @param unit    the descriptor; its "files" entry lists the input files
+ */
+void Prefetcher::submit(int visit, PropertySet::Ptr unit) {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _units[visit] = unit;
+    _queue.push_back(visit);
+    _changed.notify_all();
+}
+
+/** Whether the descriptor of the given visit has been submitted
+ */
+bool Prefetcher::hasUnit(int visit) {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    return _units.count(visit) > 0;
+}
+
+/** Start the given visit: release the files and descriptors of the earlier
+ * visits, making room for those of the next.
+ * @return the descriptor of the visit; an empty PropertySet if there is none
+ */
+PropertySet::Ptr Prefetcher::beginVisit(int visit) {
+
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _currentVisit = visit;
+
+    std::list<StagedFile>::iterator iter = _staged.begin();
+    while (iter != _staged.end()) {
+        if (iter->visit < visit) {
+            release(*iter);
+            iter = _staged.erase(iter);
+        }
+        else {
+            iter++;
+        }
+    }
+    _units.erase(_units.begin(), _units.lower_bound(visit));
+    _changed.notify_all();
+
+    std::map<int, PropertySet::Ptr>::iterator unit = _units.find(visit);
+    if (unit == _units.end()) {
+        return PropertySet::Ptr(new PropertySet);
+    }
+    return unit->second;
+}
+
+/** Stop the thread, once it has finished the file it is reading, and
+ * release all files.
+ */
+void Prefetcher::stop() {
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        _stopping = true;
+        _changed.notify_all();
+    }
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    std::list<StagedFile>::iterator iter;
+    for (iter = _staged.begin(); iter != _staged.end(); iter++) {
+        release(*iter);
+    }
+    _staged.clear();
+}
+
+/** Whether the given file is mapped in memory
+ */
+bool Prefetcher::isStaged(const std::string& path) {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    std::list<StagedFile>::iterator iter;
+    for (iter = _staged.begin(); iter != _staged.end(); iter++) {
+        if (iter->path == path) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** get the number of bytes of files mapped or being read in
+ */
+long long Prefetcher::getStagedBytes() {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    return _used;
+}
+
+/** The loop of the staging thread: take the descriptors in the order they
+ * were submitted and stage their files, skipping visits already over.
+ */
+void Prefetcher::run() {
+
+    while (true) {
+        int visit;
+        PropertySet::Ptr unit;
+        {
+            boost::unique_lock<boost::mutex> lock(_mutex);
+            while (!_stopping && _queue.empty()) {
+                _changed.wait(lock);
+            }
+            if (_stopping) {
+                return;
+            }
+            visit = _queue.front();
+            _queue.pop_front();
+            if (visit < _currentVisit || _units.count(visit) == 0) {
+                continue;
+            }
+            unit = _units[visit];
+        }
+
+        std::vector<std::string> files;
+        try {
+            if (unit->exists("files")) {
+                files = unit->getArray<std::string>("files");
+            }
+        }
+        catch (std::exception&) {
+            /* Not a list of file names: nothing to stage */
+        }
+
+        for (unsigned int i = 0; i < files.size(); i++) {
+            if (!stage(visit, files[i])) {
+                break;
+            }
+        }
+    }
+}
+
+/** Map a file with its pages read in, once there is room for it.  Files
+ * that cannot be opened are left to the Stage to report.
+ * @return false if the thread is stopping or the visit is over
+ */
+bool Prefetcher::stage(int visit, const std::string& path) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return true;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0 || status.st_size > _capacity) {
+        close(fd);
+        return true;
+    }
+    size_t size = status.st_size;
+
+    {
+        boost::unique_lock<boost::mutex> lock(_mutex);
+        while (!_stopping && visit >= _currentVisit && _used + status.st_size > _capacity) {
+            _changed.wait(lock);
+        }
+        if (_stopping || visit < _currentVisit) {
+            close(fd);
+            return false;
+        }
+        _used += size;
+    }
+
+#ifdef MAP_POPULATE
+    void* address = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+#else
+    void* address = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address != MAP_FAILED) {
+        /* Touch each page to read it in */
+        volatile char sum = 0;
+        long pageSize = sysconf(_SC_PAGESIZE);
+        for (size_t offset = 0; offset < size; offset += pageSize) {
+            sum += static_cast<const char*>(address)[offset];
+        }
+    }
+#endif
+    close(fd);
+
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    if (address == MAP_FAILED) {
+        _used -= size;
+        _changed.notify_all();
+        return true;
+    }
+
+    StagedFile file;
+    file.path = path;
+    file.visit = visit;
+    file.address = address;
+    file.size = size;
+    if (visit < _currentVisit) {
+        release(file);
+        return false;
+    }
+    _staged.push_back(file);
+    return true;
+}
+
+/** Unmap a file and give back its room.  Called with the mutex held.
+ */
+void Prefetcher::release(StagedFile& file) {
+    munmap(file.address, file.size);
+    _used -= file.size;
+    _changed.notify_all();
+}
+
+}
+}
+}
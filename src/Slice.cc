@@ -36,7 +36,15 @@
   */
 
 
+#include <cstdio>
+#include <cstring>
+
+#include <boost/thread/thread.hpp>
+
 #include "lsst/pex/mpiharness/Slice.h"
+#include "lsst/pex/mpiharness/Control.h"
+#include "lsst/pex/mpiharness/CpuAffinity.h"
+#include "lsst/pex/mpiharness/MemoryUsage.h"
 #include "lsst/pex/logging/Log.h"
 #include <lsst/pex/policy/Policy.h>
 
@@ -48,13 +56,33 @@ namespace lsst {
 namespace pex {
 namespace mpiharness {
 
+namespace {
+    const char* const threadLevelNames[] = { "single", "funneled", "serialized", "multiple" };
+    const int threadLevels[] = { MPI_THREAD_SINGLE, MPI_THREAD_FUNNELED,
+                                 MPI_THREAD_SERIALIZED, MPI_THREAD_MULTIPLE };
+    const int nThreadLevels = 4;
+
+    /* the first component of a dotted PropertySet name */
+    std::string topLevelName(const std::string& name) {
+        return name.substr(0, name.find('.'));
+    }
+}
+
 /** 
  * Constructor.
  * @param pipename   a name to identify the pipeline.  This is used in setting 
  *                      up the logger.
  */
 Slice::Slice(const std::string& pipename) 
-    : _pid(getpid()), _rank(-2),   _pipename(pipename),  _logutils(LogUtils()) 
+    : _pid(getpid()), _rank(-2), _threadLevel(MPI_THREAD_FUNNELED), _nThreads(1),
+      _controlGroupSize(0), _affinity("none"), _sharedPool(false), _compressionThreshold(-1), 
+      _incrementalSync(false), _syncPrimed(false), _diffGeneration(0), _syncCount(0), 
+      _memoryAccounting(false), 
+      _rssBegin(0.0), _peakReset(true),
+      _visitHandshake(false), _controlRequest(MPI_REQUEST_NULL), _paused(false), _draining(false),
+      _visit(0), _workUnitVisit(0), _stage(0), _stageBegin(0.0), _commandWait(0.0), 
+      _speculative(false), _speculationSequence(0), _speculationEnded(false), 
+      topologyIntracomm(MPI_COMM_NULL), _pipename(pipename),  _logutils(LogUtils()) 
 { }
 
 /** Destructor.
@@ -67,15 +95,25 @@ Slice::~Slice(void) {
 /** Initialize the MPI environment of the Slice.
  * In doing so, obtain a reference to the Intercommunicator of the 
  * Pipeline and the Slices. Find and record the Slice rank and the
- * universe size.
+ * universe size.  MPI is initialized at the requested thread level; 
+ * the level actually provided is recorded and logged if it is lower.
  */
 void Slice::initializeMPI() {
 
-    mpiError = MPI_Init(NULL, NULL);  
+    int provided;
+    int required = _threadLevel;
+    mpiError = MPI_Init_thread(NULL, NULL, required, &provided);  
     if (mpiError != MPI_SUCCESS){
         MPI_Finalize();
         exit(1);
     }
+    _threadLevel = provided;
+
+    if (provided < required) {
+        Log sliceLog(_logutils.getLogger(), "initializeMPI.cpp");
+        sliceLog.log(Log::WARN, boost::format("MPI provided thread level %d, less than requested %d ") 
+                     % provided % required);
+    }
 
     mpiError = MPI_Comm_get_parent(&sliceIntercomm);
     if (mpiError != MPI_SUCCESS){
@@ -97,7 +135,8 @@ void Slice::initializeMPI() {
         exit(1);
     }
 
-    if (intercommsize != 1) {
+    /* One or more Pipeline ranks; the first of them commands the Slices */
+    if (intercommsize < 1) {
         MPI_Finalize();
         exit(1);
     }
@@ -119,9 +158,278 @@ void Slice::initializeMPI() {
     }
     universeSize = *universeSizep;
 
+    initializeControlTree();
+
     return;
 }
 
+/** Build the two-level control tree.  The Slices are grouped by node (or 
+ * into groups of a fixed size, if one was set); the lowest rank of each 
+ * group is its leader and receives commands from the Pipeline over 
+ * controlIntercomm, relaying them to the group over nodeComm.  Each Slice
+ * thus keeps a constant amount of control state however many are running.
+ */
+void Slice::initializeControlTree() {
+
+    /* The Pipeline ranks come first in harnessComm */
+    mpiError = MPI_Intercomm_merge(sliceIntercomm, 1, &harnessComm);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    int color;
+    if (_controlGroupSize > 0) {
+        color = _rank / _controlGroupSize;
+    }
+    else {
+        color = getHostColor();
+    }
+
+    mpiError = MPI_Comm_split(MPI_COMM_WORLD, color, _rank, &nodeComm);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    int nodeRank;
+    mpiError = MPI_Comm_rank(nodeComm, &nodeRank);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    bool isLeader = (nodeRank == 0);
+    MPI_Comm leaderComm;
+    mpiError = MPI_Comm_split(MPI_COMM_WORLD, isLeader ? 0 : MPI_UNDEFINED, _rank, &leaderComm);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    controlIntercomm = MPI_COMM_NULL;
+    if (isLeader) {
+        mpiError = MPI_Intercomm_create(leaderComm, 0, harnessComm, 0, CONTROL_TREE_TAG, 
+                                        &controlIntercomm);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+        MPI_Comm_free(&leaderComm);
+    }
+
+    int nodeSize;
+    MPI_Comm_size(nodeComm, &nodeSize);
+
+    Log sliceLog(_logutils.getLogger(), "initializeControlTree.cpp");
+    sliceLog.log(Log::INFO, boost::format("Control tree: rank %d is %s of a group of %d ") 
+                 % _rank % (isLeader ? "leader" : "member") % nodeSize);
+}
+
+/** Hash the processor name into a color for MPI_Comm_split, so that the 
+ * Slices of one node end up in one communicator.
+ */
+int Slice::getHostColor() {
+
+    char name[MPI_MAX_PROCESSOR_NAME];
+    int length;
+    mpiError = MPI_Get_processor_name(name, &length);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+    unsigned int hash = 5381;
+    for (int i = 0; i < length; i++) {
+        hash = hash * 33 + static_cast<unsigned char>(name[i]);
+    }
+    return static_cast<int>(hash & 0x7fffffff);
+}
+
+/** Pin the Slice to cores of its node, and its memory to their NUMA nodes,
+ * by the placement strategy set with setAffinity().  The Slice's rank among
+ * the Slices of its node decides which cores it gets.  Failing to pin is 
+ * logged but not fatal.
+ */
+void Slice::bindToCores() {
+
+    if (_affinity == "none") {
+        return;
+    }
+
+    MPI_Comm hostComm;
+    mpiError = MPI_Comm_split(MPI_COMM_WORLD, getHostColor(), _rank, &hostComm);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    int localRank, localSize;
+    MPI_Comm_rank(hostComm, &localRank);
+    MPI_Comm_size(hostComm, &localSize);
+    MPI_Comm_free(&hostComm);
+
+    CpuAffinity affinity;
+    std::vector<int> cpus = affinity.choose(_affinity, localRank, localSize);
+    bool bound = affinity.apply(cpus);
+
+    Log sliceLog(_logutils.getLogger(), "bindToCores.cpp");
+    sliceLog.log(bound ? Log::INFO : Log::WARN,
+        boost::format("Affinity %s: rank %d is local rank %d of %d, %s to cpus %s memory nodes %s ") 
+        % _affinity % _rank % localRank % localSize % (bound ? "bound" : "failed to bind")
+        % CpuAffinity::format(cpus) % CpuAffinity::format(affinity.getNodes(cpus)));
+}
+
+/** Receive a command from the Pipeline through the control tree.  When the
+ * Slice pool is shared, the Slice first waits asleep for the word that a 
+ * command is coming, so that an idle Slice leaves its core to the Slices
+ * of the Pipeline that holds the pool.
+ */
+void Slice::receiveCommand(void* buffer, int count, MPI_Datatype datatype) {
+
+    if (_sharedPool) {
+        if (controlIntercomm != MPI_COMM_NULL) {
+            awaitWake(0, controlIntercomm);
+            int nodeSize;
+            MPI_Comm_size(nodeComm, &nodeSize);
+            for (int i = 1; i < nodeSize; i++) {
+                mpiError = MPI_Send(NULL, 0, MPI_BYTE, i, CONTROL_WAKE_TAG, nodeComm);
+                if (mpiError != MPI_SUCCESS){
+                    MPI_Finalize();
+                    exit(1);
+                }
+            }
+        }
+        else {
+            awaitWake(0, nodeComm);
+        }
+    }
+
+    if (controlIntercomm != MPI_COMM_NULL) {
+        mpiError = MPI_Bcast(buffer, count, datatype, 0, controlIntercomm);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+
+    mpiError = MPI_Bcast(buffer, count, datatype, 0, nodeComm);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+}
+
+/** Wait for an empty CONTROL_WAKE_TAG message from the given rank without
+ * spinning: probe, and sleep for longer and longer (up to 100 us) while 
+ * nothing has come.  The cap bounds the latency a sleeping Slice adds to
+ * each command, at the cost of waking up to 10000 times a second while idle.
+ */
+void Slice::awaitWake(int source, MPI_Comm comm) {
+
+    long pause = 10;
+    int flag = 0;
+    for (;;) {
+        mpiError = MPI_Iprobe(source, CONTROL_WAKE_TAG, comm, &flag, MPI_STATUS_IGNORE);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+        if (flag) {
+            break;
+        }
+        boost::this_thread::sleep(boost::posix_time::microseconds(pause));
+        if (pause < 100) {
+            pause *= 2;
+        }
+    }
+
+    mpiError = MPI_Recv(NULL, 0, MPI_BYTE, source, CONTROL_WAKE_TAG, comm, MPI_STATUS_IGNORE);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+}
+
+/** Enter the barrier matching Pipeline::controlBarrier().  The group 
+ * leader reports to the Pipeline once every Slice of its group has arrived,
+ * and does not wait for the Pipeline, so that the Pipeline may poll for 
+ * the reports.
+ */
+void Slice::controlBarrier() {
+
+    ReportLoc report[REPORT_FIELDS];
+    for (int i = 0; i < REPORT_FIELDS; i++) {
+        report[i].value = 0.0;
+        report[i].rank = _rank;
+    }
+    sendReport(report);
+}
+
+/** Send the memory use of this Slice and its node to the Pipeline in 
+ * place of the report of controlBarrier(); the Pipeline keeps the largest 
+ * value of each field over all Slices.
+ */
+void Slice::reportMemory(double rssBegin //!< The resident size at the start of the Stage, in MB
+                         ) {
+
+    ReportLoc report[REPORT_FIELDS];
+    MemoryUsage::sample(report, rssBegin, _rank);
+    sendReport(report);
+}
+
+/** Reduce the reports of the group to its leader, which sends the result 
+ * to the root of the Pipeline, adding the time the Slice waited for the 
+ * command of the current Stage and has spent in it.
+ */
+void Slice::sendReport(ReportLoc* report //!< REPORT_FIELDS entries
+                       ) {
+
+    report[REPORT_COMMAND_WAIT].value = _commandWait;
+    report[REPORT_PROCESS_TIME].value = MPI_Wtime() - _stageBegin;
+
+    if (_sharedPool) {
+        int nodeRank;
+        int nodeSize;
+        MPI_Comm_rank(nodeComm, &nodeRank);
+        MPI_Comm_size(nodeComm, &nodeSize);
+        if (nodeRank == 0) {
+            for (int i = 1; i < nodeSize; i++) {
+                awaitWake(MPI_ANY_SOURCE, nodeComm);
+            }
+        }
+        else {
+            mpiError = MPI_Send(NULL, 0, MPI_BYTE, 0, CONTROL_WAKE_TAG, nodeComm);
+            if (mpiError != MPI_SUCCESS){
+                MPI_Finalize();
+                exit(1);
+            }
+        }
+    }
+
+    ReportLoc group[REPORT_FIELDS];
+    mpiError = MPI_Reduce(report, group, REPORT_FIELDS, MPI_DOUBLE_INT, MPI_MAXLOC, 0, nodeComm);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    if (controlIntercomm != MPI_COMM_NULL) {
+        mpiError = MPI_Send(group, REPORT_FIELDS, MPI_DOUBLE_INT, 0, CONTROL_DONE_TAG, 
+                            controlIntercomm);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+}
+
+/** set method for the size of the Slice groups of the control tree; 0 
+ * groups the Slices by node.  Must be called before initialize() to take effect.
+ */
+void Slice::setControlGroupSize(int groupSize) {
+    _controlGroupSize = (groupSize > 0) ? groupSize : 0;
+}
+
 /** Set configuration for the Slice.
  */
 void Slice::configureSlice() {
@@ -130,7 +438,9 @@ void Slice::configureSlice() {
     return;
 }
 
-/** Initialize the environment of the Slice.
+/** Initialize the environment of the Slice.  This includes starting the
+ * ThreadPool that Stages may use to fan out work within this Slice, and 
+ * the communicator that VisitFiles are written over.
  */
 void Slice::initialize() {
 
@@ -138,30 +448,299 @@ void Slice::initialize() {
 
     configureSlice();
 
+    mpiError = MPI_Comm_dup(MPI_COMM_WORLD, &outputComm);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+    VisitFile::setCommunicator(outputComm);
+
+    bindToCores();
+
+    _threadPool.reset(new ThreadPool(_nThreads));
+    ThreadPool::setDefault(_threadPool);
+
+    postControlReceive();
+
+    Log sliceLog(_logutils.getLogger(), "initialize.cpp");
+    sliceLog.log(Log::INFO, boost::format("MPI thread level %s, %d threads ") 
+                 % getThreadLevel() % _nThreads);
+
     return;
 }
 
-/** Invoke the Shutdown test from the Pipeline. 
- * This is done by receiving a message from the Pipeline, and if 
- * instructed, running shutdown on ths Slice.
+/** Begin a visit: take in the control messages and work unit descriptors
+ * that have arrived from the Pipeline.  A Slice learns that the Pipeline shuts down from the 
+ * command of the next Stage, unless the visit handshake is on; then it 
+ * waits here for the Pipeline to send "CONTINUE" or "SHUTDOWN", and if 
+ * instructed, runs shutdown on this Slice.
  */
 void Slice::invokeShutdownTest() {
 
-    char shutdownCommand[bufferSize];
+    _visit++;
+
+    testControl(false);
+    receivePrefetch(false);
+
+    if (_visitHandshake) {
+        char shutdownCommand[bufferSize];
+        receiveVisitCommand(shutdownCommand);
+    }
+
+    TraceBuffer::getInstance().record(TRACE_VISIT_BEGIN, _rank, 0);
+}
+
+/** Receive the next command from the Pipeline, first answering its memory
+ * polls and applying its reconfigurations, and shut down if the command 
+ * is "SHUTDOWN".
+ */
+void Slice::receiveVisitCommand(char* command //!< A buffer of bufferSize characters
+                                ) {
+
+    receiveCommand(command, bufferSize, MPI_CHAR);
+
+    /* The Pipeline polls the memory of the nodes and reconfigures the 
+       Slices before it dispatches a visit */
+    while (true) {
+        if (!strcmp(command, "MEMORY")) {
+            reportMemory(MemoryUsage::getRss());
+        }
+        else if (!strcmp(command, "RECONFIGURE")) {
+            receiveReconfiguration();
+        }
+        else {
+            break;
+        }
+        receiveCommand(command, bufferSize, MPI_CHAR);
+    }
+
+    if (!strcmp(command, "SHUTDOWN")) {
+        shutdown();
+    }
+}
+
+/** Receive the packed delta that follows the command "RECONFIGURE" and 
+ * apply its log threshold and topology; the neighbors are calculated 
+ * again for a new topology.  The delta is kept for takeReconfiguration(), 
+ * which applies the Stage policy changes in Python.
+ */
+void Slice::receiveReconfiguration() {
+
+    int size;
+    receiveCommand(&size, 1, MPI_INT);
+    boost::mpi::packed_iarchive archive(world);
+    archive.resize(size);
+    receiveCommand(archive.address(), size, MPI_PACKED);
+
+    PropertySet::Ptr delta;
+    archive >> delta;
+
+    Log sliceLog(_logutils.getLogger(), "receiveReconfiguration.cpp");
+    sliceLog.log(Log::INFO, boost::format("Reconfiguring the Slice: %s") % delta->toString());
+
+    if (delta->exists("logThreshold")) {
+        _logutils.getLogger().setThreshold(delta->get<int>("logThreshold"));
+    }
+
+    if (delta->exists("topology")) {
+        PropertySet::Ptr topology = delta->get<PropertySet::Ptr>("topology");
+        pexPolicy::Policy::Ptr policy(new pexPolicy::Policy);
+        std::string type = topology->get<std::string>("type");
+        policy->set("type", type);
+        if (topology->exists("param1")) {
+            if (type == "ring") {
+                policy->set("param1", topology->get<std::string>("param1"));
+            }
+            else {
+                policy->set("param1", topology->get<int>("param1"));
+            }
+        }
+        if (topology->exists("param2")) {
+            policy->set("param2", topology->get<int>("param2"));
+        }
+        setTopology(policy);
+        calculateNeighbors();
+    }
+
+    _reconfiguration = delta;
+}
+
+/** get the reconfiguration received before the current visit, for the 
+ * Stages to apply to their policies, and forget it; an empty PropertySet 
+ * if there was none
+ */
+PropertySet::Ptr Slice::takeReconfiguration() {
+    PropertySet::Ptr delta = _reconfiguration;
+    _reconfiguration.reset();
+    if (!delta) {
+        return PropertySet::Ptr(new PropertySet);
+    }
+    return delta;
+}
 
-    mpiError = MPI_Bcast(shutdownCommand, bufferSize, MPI_CHAR, 0, sliceIntercomm);
+/** Post the receive for the next control message from the root of the 
+ * Pipeline.
+ */
+void Slice::postControlReceive() {
+    mpiError = MPI_Irecv(_controlMessage, CONTROL_MESSAGE_SIZE, MPI_CHAR, 0, CONTROL_MESSAGE_TAG,
+                         sliceIntercomm, &_controlRequest);
     if (mpiError != MPI_SUCCESS){
         MPI_Finalize();
         exit(1);
     }
+}
+
+/** Act on the control messages that have arrived from the Pipeline: 
+ * "PAUSE" and "RESUME", "DRAIN", and "LOGLEVEL <threshold>".  Costs one 
+ * MPI_Test when there is none.
+ * @param hold   whether to wait here, while paused, for "RESUME"
+ */
+void Slice::testControl(bool hold) {
+
+    while (_controlRequest != MPI_REQUEST_NULL) {
 
+        int flag = 0;
+        if (hold && _paused) {
+            mpiError = MPI_Wait(&_controlRequest, MPI_STATUS_IGNORE);
+            flag = 1;
+        }
+        else {
+            mpiError = MPI_Test(&_controlRequest, &flag, MPI_STATUS_IGNORE);
+        }
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+        if (!flag) {
+            return;
+        }
 
-    if(strcmp(shutdownCommand, "SHUTDOWN")) {
+        _controlMessage[CONTROL_MESSAGE_SIZE - 1] = '\0';
+        std::string message(_controlMessage);
+        int threshold;
+
+        Log sliceLog(_logutils.getLogger(), "testControl.cpp");
+        sliceLog.log(Log::DEBUG, boost::format("Control message %s") % message);
+
+        if (message == "PAUSE") {
+            _paused = true;
+        }
+        else if (message == "RESUME") {
+            _paused = false;
+        }
+        else if (message == "DRAIN") {
+            _draining = true;
+        }
+        else if (std::sscanf(_controlMessage, "LOGLEVEL %d", &threshold) == 1) {
+            _logutils.getLogger().setThreshold(threshold);
+        }
+        else {
+            sliceLog.log(Log::WARN, boost::format("Unknown control message %s") % message);
+        }
+
+        postControlReceive();
     }
-    else {
-        shutdown();
+}
+
+/** Whether the Pipeline has told the Slices that it is draining: it 
+ * finishes the current visit and then shuts down.
+ */
+bool Slice::isDraining() {
+    return _draining;
+}
+
+/** Receive the work unit descriptors that have arrived from the Pipeline 
+ * and hand them to the Prefetcher.  Costs one MPI_Iprobe when there is none.
+ * @param wait   whether to wait for the descriptor of the current visit
+ */
+void Slice::receivePrefetch(bool wait) {
+
+    if (!_prefetcher) {
+        return;
+    }
+
+    while (true) {
+        MPI_Status status;
+        int flag = 0;
+        if (wait && !_prefetcher->hasUnit(_visit)) {
+            mpiError = MPI_Probe(0, VISIT_PREFETCH_TAG, sliceIntercomm, &status);
+            flag = 1;
+        }
+        else {
+            mpiError = MPI_Iprobe(0, VISIT_PREFETCH_TAG, sliceIntercomm, &flag, &status);
+        }
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+        if (!flag) {
+            return;
+        }
+
+        int count;
+        MPI_Get_count(&status, MPI_PACKED, &count);
+        boost::mpi::packed_iarchive archive(world);
+        archive.resize(count);
+        mpiError = MPI_Recv(archive.address(), count, MPI_PACKED, 0, VISIT_PREFETCH_TAG, 
+                            sliceIntercomm, MPI_STATUS_IGNORE);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+
+        PropertySet::Ptr unit;
+        archive >> unit;
+        _prefetcher->submit(unit->get<int>("visit"), unit);
+    }
+}
+
+/** set method for the staging area of the Prefetcher, in bytes: the Slice 
+ * receives the descriptor of its work unit for each visit from the visit
+ * queue of the Pipeline, and the files it names are read in ahead of the 
+ * visit.  0 turns the Prefetcher off.  Only for a Pipeline with its visit
+ * queue on (runMpiSlice.py -q), and must be called before the first visit.
+ */
+void Slice::setPrefetch(long long capacity) {
+    if (_prefetcher) {
+        _prefetcher->stop();
+    }
+    _prefetcher.reset();
+    if (capacity > 0) {
+        _prefetcher.reset(new Prefetcher(capacity));
     }
+}
+
+/** get the descriptor of the work unit of this Slice for the current visit,
+ * as queued on the Pipeline; an empty PropertySet if there is none or the 
+ * Prefetcher is off.  Available from the first Stage of the visit on.
+ */
+PropertySet::Ptr Slice::getWorkUnit() {
+    if (!_workUnit) {
+        return PropertySet::Ptr(new PropertySet);
+    }
+    return _workUnit;
+}
+
+/** get the Prefetcher of this Slice; null if it is off
+ */
+Prefetcher::Ptr Slice::getPrefetcher() {
+    return _prefetcher;
+}
+
+/** get the threshold of the log of this Slice, which the Pipeline may 
+ * change with a control message
+ */
+int Slice::getLogThreshold() {
+    return _logutils.getLogger().getThreshold();
+}
 
+/** set method for the visit handshake: with it on, each visit starts with
+ * the Slices waiting in invokeShutdownTest() for the Pipeline.  Needed when 
+ * the Slices wait for an event before the first Stage.  The Pipeline must 
+ * be set up the same way.
+ */
+void Slice::setVisitHandshake(bool handshake) {
+    _visitHandshake = handshake;
 }
 
 /** Invoke the MPI_Bcast in coordination with the Pipeline (prior to 
@@ -173,23 +752,145 @@ void Slice::invokeBcast(int iStage //!< The integer index of the current Stage
     char runCommand[bufferSize];
     int kStage;
 
-    Log sliceLog(_logutils.getLogger(), "invokeBcast.cpp");
+    TraceBuffer& trace = TraceBuffer::getInstance();
+    trace.record(TRACE_BCAST_BEGIN, _rank, iStage);
+
+    testControl(false);
+
+    double waitBegin = MPI_Wtime();
+
+    receiveVisitCommand(runCommand);
+
+    receiveCommand(&kStage, 1, MPI_INT);
+    _stage = iStage;
+    _syncCount = 0;
+    _stageBegin = MPI_Wtime();
+    _commandWait = _stageBegin - waitBegin;
+
+    /* The descriptor of the visit was sent before its first command */
+    if (_prefetcher && _workUnitVisit != _visit) {
+        receivePrefetch(true);
+        _workUnit = _prefetcher->beginVisit(_visit);
+        _workUnitVisit = _visit;
+    }
+    else {
+        receivePrefetch(false);
+    }
+
+    _speculative = (std::sscanf(runCommand, "SPECULATE %d", &_speculationSequence) == 1);
+    _speculationEnded = false;
+    _pendingUnits.clear();
+    _cancelledUnits.clear();
+
+    if (_memoryAccounting) {
+        _rssBegin = MemoryUsage::getRss();
+        if (_peakReset && !MemoryUsage::resetPeakRss()) {
+            _peakReset = false;
+            Log sliceLog(_logutils.getLogger(), "invokeBcast.cpp");
+            sliceLog.log(Log::WARN, 
+                "Cannot reset the peak resident size: peakRss is the peak of the Slice's life");
+        }
+    }
+
+    trace.record(TRACE_BCAST_END, _rank, iStage, kStage);
+}
 
-    Log localLog(sliceLog, "invokeBcast()");    
-    localLog.log(Log::INFO, boost::format("Invoking Bcast: %d ") % iStage);
+/** Whether the current Stage is speculative.  If so the Slice reports its 
+ * work unit with reportWorkUnit() and runs the work units handed out by 
+ * nextWorkUnit() instead of entering invokeBarrier().
+ */
+bool Slice::isSpeculative() {
+    return _speculative;
+}
 
-    mpiError = MPI_Bcast(runCommand, bufferSize, MPI_CHAR, 0, sliceIntercomm);
+/** Tell the Pipeline that this Slice has finished (or given up on) a work 
+ * unit of the current speculative Stage.  A failed copy of another Slice's
+ * work unit does not count as done.
+ */
+void Slice::reportWorkUnit(int unit,       //!< The work unit, i.e. the rank of the Slice it belongs to
+                           bool succeeded  //!< Whether the work unit was completed
+                           ) {
+
+    int msg[3] = { _speculationSequence, unit, 
+                   (succeeded || unit == _rank) ? SPECULATION_DONE : SPECULATION_FAILED };
+
+    TraceBuffer::getInstance().record(TRACE_UNIT_DONE, _rank, _stage, unit, msg[2]);
+    mpiError = MPI_Send(msg, 3, MPI_INT, 0, SPECULATION_TAG, harnessComm);
     if (mpiError != MPI_SUCCESS){
         MPI_Finalize();
         exit(1);
     }
+}
+
+/** Wait for the Pipeline to hand this Slice another work unit of the 
+ * current speculative Stage, a copy of that of a straggling Slice.
+ * @return the work unit, or -1 once the Stage is over
+ */
+int Slice::nextWorkUnit() {
+
+    while (_pendingUnits.empty() && !_speculationEnded) {
+        receiveSpeculation();
+    }
+
+    if (_pendingUnits.empty()) {
+        return -1;
+    }
+
+    int unit = _pendingUnits.front();
+    _pendingUnits.pop_front();
+    return unit;
+}
+
+/** Whether the Pipeline has cancelled this Slice's copy of a work unit 
+ * because another copy finished first.  Does not block; a speculative 
+ * Stage must call it from time to time and return early, or the Slice 
+ * holds up the next Stage of its group.
+ */
+bool Slice::isCancelled(int unit //!< The work unit being run
+                        ) {
+
+    int flag = 1;
+    while (flag) {
+        mpiError = MPI_Iprobe(0, SPECULATION_TAG, harnessComm, &flag, MPI_STATUS_IGNORE);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+        if (flag) {
+            receiveSpeculation();
+        }
+    }
+    return _cancelledUnits.count(unit) > 0;
+}
 
-    mpiError = MPI_Bcast(&kStage, 1, MPI_INT, 0, sliceIntercomm);
+/** Receive one speculation message from the Pipeline.  Messages left over 
+ * from an earlier speculative Stage are dropped.
+ */
+void Slice::receiveSpeculation() {
+
+    int msg[3];
+    mpiError = MPI_Recv(msg, 3, MPI_INT, 0, SPECULATION_TAG, harnessComm, MPI_STATUS_IGNORE);
     if (mpiError != MPI_SUCCESS){
         MPI_Finalize();
         exit(1);
     }
 
+    if (msg[0] != _speculationSequence) {
+        return;
+    }
+
+    switch (msg[2]) {
+    case SPECULATION_RUN:
+        _pendingUnits.push_back(msg[1]);
+        break;
+    case SPECULATION_CANCEL:
+        _cancelledUnits.insert(msg[1]);
+        TraceBuffer::getInstance().record(TRACE_SPECULATE_CANCEL, _rank, 0, msg[1]);
+        break;
+    case SPECULATION_END:
+        _speculationEnded = true;
+        break;
+    }
 }
 
 /** Invoke the MPI_Barrier in coordination with the Pipeline (after the 
@@ -198,24 +899,109 @@ void Slice::invokeBcast(int iStage //!< The integer index of the current Stage
 void Slice::invokeBarrier(int iStage //!< The integer index of the current Stage 
                           ) {
 
-    Log sliceLog(_logutils.getLogger(), "invokeBarrier.cpp");
+    TraceBuffer& trace = TraceBuffer::getInstance();
+    trace.record(TRACE_BARRIER_BEGIN, _rank, iStage);
 
-    Log localLog(sliceLog, "invokeBarrier()");    
-    localLog.log(Log::INFO, boost::format("Invoking Barrier: %d ") % iStage);
+    /* A paused Slice holds here, so the Pipeline waits for it */
+    testControl(true);
+    receivePrefetch(false);
 
-    mpiError = MPI_Barrier(sliceIntercomm);
-    if (mpiError != MPI_SUCCESS){
-        MPI_Finalize();
-        exit(1);
+    if (_memoryAccounting) {
+        reportMemory(_rssBegin);
     }
+    else {
+        controlBarrier();
+    }
+
+    trace.record(TRACE_BARRIER_END, _rank, iStage);
+}
+
+
+/** Write the hot-path TraceBuffer of this Slice to a file. 
+ */
+void Slice::dumpTrace(const std::string& filename) {
+    TraceBuffer::getInstance().dump(filename);
+}
+
+/** set method for the size in bytes from which the PropertySets sent by 
+ * syncSlices() are compressed; negative turns compression off
+ */
+void Slice::setCompressionThreshold(int threshold) {
+    _compressionThreshold = threshold;
+}
 
+/** set method for memory accounting: each Slice reports its resident size 
+ * at the start and end of every non-speculative Stage, and its peak 
+ * resident size, to the Pipeline.  The Pipeline must be set up the same way.
+ */
+void Slice::setMemoryAccounting(bool accounting) {
+    _memoryAccounting = accounting;
+}
+
+/** set method for the incremental mode of syncSlices(): after the first
+ * exchange a Slice sends only the entries of its PropertySet that were added,
+ * changed or removed since its previous exchange
+ */
+void Slice::setIncrementalSync(bool incremental) {
+    _incrementalSync = incremental;
 }
 
+/** set the file the TraceBuffer is written to when the Slice shuts down.
+ * The Slice exits from within invokeShutdownTest(), so this cannot be left
+ * to the caller.
+ */
+void Slice::setTraceFile(const std::string& filename) {
+    _traceFile = filename;
+}
+
+/** Release the control tree and disconnect from the Pipeline before 
+ * MPI_Finalize, so that no process finalizes while another still holds 
+ * a connection to it.
+ */
+void Slice::disconnect() {
+    testControl(false);
+    receivePrefetch(false);
+    if (_controlRequest != MPI_REQUEST_NULL) {
+        MPI_Cancel(&_controlRequest);
+        MPI_Wait(&_controlRequest, MPI_STATUS_IGNORE);
+    }
+    _lastSync.reset();
+    _syncHandles.clear();
+    _exchangePlan.reset();
+    if (controlIntercomm != MPI_COMM_NULL) {
+        MPI_Comm_free(&controlIntercomm);
+    }
+    VisitFile::setCommunicator(MPI_COMM_NULL);
+    MPI_Comm_free(&outputComm);
+    MPI_Comm_free(&nodeComm);
+    MPI_Comm_free(&harnessComm);
+    MPI_Comm_disconnect(&sliceIntercomm);
+}
 
 /** Shutdown the Slice by calling MPI_Finalize and then exit(). 
  */
 void Slice::shutdown() {
 
+    if (_threadPool) {
+        _threadPool->stop();
+    }
+
+    if (_prefetcher) {
+        _prefetcher->stop();
+    }
+
+    if (!_traceFile.empty()) {
+        dumpTrace(_traceFile);
+    }
+
+    PayloadStats& stats = PayloadStats::getInstance();
+    if (stats.getMessages() > 0) {
+        Log sliceLog(_logutils.getLogger(), "shutdown.cpp");
+        sliceLog.log(Log::INFO, boost::format("syncSlices: %s ") % stats.toString());
+    }
+
+    disconnect();
+
     MPI_Finalize();
     exit(0);
 }
@@ -257,6 +1043,67 @@ char* Slice::getRunId() {
     return _runId;
 }
 
+/** set method for the MPI thread level requested at initialization: one of
+ * "single", "funneled", "serialized" or "multiple".  Must be called before 
+ * initialize() to take effect.
+ */
+void Slice::setThreadLevel(const std::string& level) {
+    for (int i = 0; i < nThreadLevels; i++) {
+        if (level == threadLevelNames[i]) {
+            _threadLevel = threadLevels[i];
+            return;
+        }
+    }
+    throw LSST_EXCEPT(lsst::pex::exceptions::InvalidParameterException,
+                      "Unknown MPI thread level: " + level);
+}
+
+/** get method for the MPI thread level; after initialize() this is the 
+ * level provided by the MPI library
+ */
+std::string Slice::getThreadLevel() {
+    for (int i = 0; i < nThreadLevels; i++) {
+        if (_threadLevel == threadLevels[i]) {
+            return threadLevelNames[i];
+        }
+    }
+    return "unknown";
+}
+
+/** set method for the placement of the Slice on the cores of its node: one of
+ * "none", "compact", "scatter" or "numa".  Must be called before initialize()
+ * to take effect.
+ */
+void Slice::setAffinity(const std::string& strategy) {
+    if (!CpuAffinity::isStrategy(strategy)) {
+        throw LSST_EXCEPT(lsst::pex::exceptions::InvalidParameterException,
+                          "Unknown affinity strategy: " + strategy);
+    }
+    _affinity = strategy;
+}
+
+/** set method for whether the Slice pool is shared with other Pipelines 
+ * through a SliceScheduler, in which case an idle Slice sleeps between 
+ * commands rather than polling in MPI, in naps of at most 100 us that add
+ * up to that much latency to each command.  Must match the Pipeline.
+ */
+void Slice::setSharedPool(bool shared) {
+    _sharedPool = shared;
+}
+
+/** set method for the number of threads in the Slice ThreadPool, including
+ * the main thread.  Must be called before initialize() to take effect.
+ */
+void Slice::setThreadCount(int nThreads) {
+    _nThreads = (nThreads < 1) ? 1 : nThreads;
+}
+
+/** get method for the ThreadPool of this Slice
+ */
+ThreadPool::Ptr Slice::getThreadPool() {
+    return _threadPool;
+}
+
 /** Get a list of ranks of neighbors Slices from which this Slice receives data
  * @returns a std vector containing integer indices of the ranks of neighbor Slices 
  * from which this Slice receives data
@@ -274,10 +1121,27 @@ std::vector<int> Slice::getRecvNeighborList() {
 /** Calculate the ranks of the neighbors Slices for this Slice.  The calculation 
  * relies on the topology that has been set for the Pipeline plus Slices, 
  * and the result is stored as a list of Slices from which this Slice receives 
- * data (recvNeighborList) and sends (sendNeighborList). 
+ * data (recvNeighborList) and sends (sendNeighborList).  Replaces the 
+ * neighbors of an earlier topology, once their last exchange has completed.
  */
 void Slice::calculateNeighbors() {
 
+    if (_lastSync) {
+        _lastSync->wait();
+    }
+
+    neighborList.clear();
+    sendNeighborList.clear();
+    recvNeighborList.clear();
+    if (topologyIntracomm != MPI_COMM_NULL) {
+        MPI_Comm_free(&topologyIntracomm);
+    }
+
+    /* New neighbors start from a full exchange */
+    _syncPrimed = false;
+    _lastSent.clear();
+    _neighborCache.clear();
+
     Log sliceLog(_logutils.getLogger(), "calculateNeighbors.cpp");
 
     Log localLog(sliceLog, "calculateNeighbors()");  
@@ -383,6 +1247,9 @@ void Slice::calculateNeighbors() {
         localLog.log(Log::INFO, boost::format("calculateNeighbors(): %d righty %d") % _rank % righty);
     }   
 
+    /* The exchanges of every visit run on one plan for the topology */
+    _exchangePlan.reset(new ExchangePlan(MPI_COMM_WORLD, sendNeighborList, recvNeighborList));
+    _syncHandles.clear();
 }
 
 /** Perform the interSlice communication, i.e., synchronized the Slices. 
@@ -390,104 +1257,145 @@ void Slice::calculateNeighbors() {
  */
 PropertySet::Ptr Slice::syncSlices(PropertySet::Ptr ps0Ptr //!< A smart pointer to a PropertySet of values to communicate 
                                    ) {
-    Log sliceLog(_logutils.getLogger(), "syncSlices.cpp");
-
-    Log localLog(sliceLog, "syncSlices()");    
+    return startSyncSlices(ps0Ptr)->wait();
+}
 
+/** Start the interSlice communication and return without waiting for it 
+ * to complete, so that a Stage can compute while the neighbor data is in
+ * flight.  The exchange is complete once the returned handle's wait() 
+ * returns.  At the "multiple" thread level a background thread progresses 
+ * the transfers; otherwise the Stage should call test() periodically.
+ * The exchanges run on the persistent ExchangePlan built by 
+ * calculateNeighbors(), so a new exchange first completes the previous one.
+ * The handles are reused: the n-th exchange before a Stage runs on the 
+ * handle of the n-th exchange before the previous Stage, so a result holds
+ * until the next Stage.
+ * @return A smart pointer to the SyncHandle of the exchange
+ */
+SyncHandle::Ptr Slice::startSyncSlices(PropertySet::Ptr ps0Ptr //!< A smart pointer to a PropertySet of values to communicate 
+                                       ) {
     char syncCommand[bufferSize];
-    localLog.log(Log::INFO, boost::format("InterSlice Communcation Command Bcast: rank %d ") % _rank);
 
-    mpiError = MPI_Bcast(syncCommand, bufferSize, MPI_CHAR, 0, sliceIntercomm);
-    if (mpiError != MPI_SUCCESS){
-        MPI_Finalize();
-        exit(1);
-    }
+    /* The command may bring a new topology */
+    receiveVisitCommand(syncCommand);
 
-    /* Ptr for the return values received from other Slices */ 
-    PropertySet::Ptr retPtr(new PropertySet);
-
-    std::vector<std::string> psNames = ps0Ptr->names();
-    std::string keyToShare = psNames[0];
-    localLog.log(Log::INFO, boost::format("Using keyToShare: %s ") % keyToShare);
-
-    int numRequests, numSendNeighbors, numRecvNeighbors; 
+    int numSendNeighbors, numRecvNeighbors; 
     numSendNeighbors = sendNeighborList.size();
     numRecvNeighbors = recvNeighborList.size();
-    numRequests = numSendNeighbors + numRecvNeighbors; 
-
-    localLog.log(Log::INFO, 
-        boost::format("Number of Neighbors is: Send  %d Recv %d  ") % numSendNeighbors % numRecvNeighbors);
-    localLog.log(Log::INFO, 
-        boost::format("Number of Requests: %d ") % numRequests );
-    
-    int count = 0;
 
-    PropertySet::Ptr recvPtr[numRecvNeighbors];
-    mpi::request reqs[numRequests];
+    TraceBuffer& trace = TraceBuffer::getInstance();
+    trace.record(TRACE_SYNC_BEGIN, _rank, 0, numSendNeighbors, numRecvNeighbors);
 
-    int destSlice, sendCount;
-    sendCount = 0;
-    std::list<int>::iterator iterSend;
-    for(iterSend = sendNeighborList.begin(); iterSend != sendNeighborList.end(); iterSend++) {
-        destSlice = (*iterSend);
-
-        localLog.log(Log::INFO, boost::format("Communicating value to Slice %d ") % destSlice);
+    if (!_exchangePlan) {
+        _exchangePlan.reset(new ExchangePlan(MPI_COMM_WORLD, sendNeighborList, recvNeighborList));
+    }
 
-        reqs[count] = world.isend(destSlice, 0, ps0Ptr);
+    /* The plan's buffers are reused, and incremental updates must be 
+       applied in order: finish the previous exchange */
+    if (_lastSync) {
+        _lastSync->wait();
+    }
 
-        count++;
-        sendCount++;
+    /* The n-th exchange before a Stage reuses the handle of the n-th 
+       exchange before the previous Stage */
+    if (_syncCount == _syncHandles.size()) {
+        _syncHandles.push_back(SyncHandle::Ptr(new SyncHandle(_rank, _exchangePlan)));
+    }
+    _lastSync = _syncHandles[_syncCount++];
+
+    SyncUpdate whole;
+    whole.values = ps0Ptr;
+    const SyncUpdate& update = _incrementalSync ? diffSync(ps0Ptr) : whole;
+
+    /* Serialize and compress once for all neighbors, into pooled buffers */
+    Payload& payload = _exchangePlan->getSendPayload();
+    _archiveBuffer.clear();
+    {
+        boost::mpi::packed_oarchive archive(world, _archiveBuffer);
+        archive << update;
+        payload.pack(archive, _compressionThreshold);
     }
 
-    localLog.log(Log::INFO, boost::format("After isends: %d ") % _rank);
+    _exchangePlan->start();
+    _lastSync->begin(_incrementalSync ? &_neighborCache : 0,
+                       (_threadLevel == MPI_THREAD_MULTIPLE) ? 0.001 : 0.0);
 
-    int srcSlice, recvCount;
-    recvCount=0;
-    std::list<int>::iterator iterRecv;
-   
-    for(iterRecv = recvNeighborList.begin(); iterRecv != recvNeighborList.end(); iterRecv++) {
-        srcSlice = (*iterRecv);
+    trace.record(TRACE_SYNC_POSTED, _rank, 0, payload.getWireSize(), numSendNeighbors);
 
-        /* perform Recvs */
-        localLog.log(Log::INFO, boost::format("Before recv call from Slice %d ") % srcSlice);
-        reqs[count] = world.irecv(srcSlice, 0, recvPtr[recvCount]);
-        localLog.log(Log::INFO, boost::format("After recv from  Slice %d recvCount %d ") % srcSlice %  recvCount);
+    /* All exchanges are posted: release the Pipeline */
+    controlBarrier();
 
-        count++;
-        recvCount++;
-    }
+    return _lastSync; 
 
-    mpi::wait_all(reqs, reqs + sendCount + recvCount);
+}
 
-    localLog.log(Log::INFO, boost::format("Past wait_all %d ") % srcSlice);
 
-    /* Combine the array of recvPtr [] into a single retPtr */ 
-    int yy = 0; 
-    std::list<int>::iterator iterNeighbors;
-    for(iterNeighbors = recvNeighborList.begin(); iterNeighbors != recvNeighborList.end(); ) {
-        int ni =  (*iterNeighbors);
-        std::stringstream newkeyBuffer;
-        std::string newkey;
-        newkeyBuffer << "neighbor-";
-        newkeyBuffer << ni;
-        newkeyBuffer >> newkey;
-        retPtr->set<PropertySet::Ptr>(newkey, recvPtr[yy]); 
+/** Work out the incremental update of the PropertySet to send: each leaf
+ * parameter, by its full dotted name, is serialized and compared with what
+ * was sent last time, so a small change deep in a nested PropertySet does
+ * not resend its siblings.  The first exchange after calculateNeighbors() 
+ * sends everything.  The update, the serialized form of each leaf and the
+ * scratch buffer are kept by the Slice and reused: a changed leaf swaps 
+ * its buffer with the scratch one, so neither is reallocated once it has
+ * seen the leaf's largest size.
+ * @return the update, valid until the next call
+ */
+const SyncUpdate& Slice::diffSync(PropertySet::Ptr ps) {
 
-        iterNeighbors++;
-        yy++;
+    SyncUpdate& update = _syncUpdate;
+    if (!update.values) {
+        update.values.reset(new PropertySet);
+        _diffEntry.reset(new PropertySet);
     }
-
-    mpiError = MPI_Barrier(sliceIntercomm);
-    if (mpiError != MPI_SUCCESS){
-        MPI_Finalize();
-        exit(1);
+    for (unsigned int i = 0; i < _diffChanged.size(); i++) {
+        update.values->remove(topLevelName(_diffChanged[i]));
+    }
+    _diffChanged.clear();
+    update.removed.clear();
+    update.full = !_syncPrimed;
+    _diffGeneration++;
+
+    /* PropertySet can only list its names by building the list */
+    std::vector<std::string> names = ps->paramNames(false);
+    for (unsigned int i = 0; i < names.size(); i++) {
+        _diffEntry->copy(names[i], ps, names[i]);
+        _diffBuffer.clear();
+        {
+            boost::mpi::packed_oarchive archive(world, _diffBuffer);
+            archive << _diffEntry;
+        }
+        _diffEntry->remove(topLevelName(names[i]));
+
+        SentLeaf& sent = _lastSent[names[i]];
+        sent.generation = _diffGeneration;
+        if (update.full || sent.bytes.size() != _diffBuffer.size() ||
+            std::memcmp(&sent.bytes[0], &_diffBuffer[0], _diffBuffer.size()) != 0) {
+            sent.bytes.swap(_diffBuffer);
+            update.values->copy(names[i], ps, names[i]);
+            _diffChanged.push_back(names[i]);
+        }
     }
 
-    return retPtr; 
+    /* Leaves not seen this time are gone, including those that have become
+       PropertySets */
+    std::map<std::string, SentLeaf>::iterator iter = _lastSent.begin();
+    while (iter != _lastSent.end()) {
+        if (iter->second.generation == _diffGeneration) {
+            iter++;
+            continue;
+        }
+        if (!update.full) {
+            update.removed.push_back(iter->first);
+        }
+        _lastSent.erase(iter++);
+    }
+    _syncPrimed = true;
 
+    TraceBuffer::getInstance().record(TRACE_SYNC_DIFF, _rank, 0, _diffChanged.size(), 
+                                      update.removed.size());
+    return update;
 }
 
-
 }
 }
 }
@@ -0,0 +1,403 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file SliceScheduler.cc
+  *
+  * \ingroup mpiharness
+  *
+  * \brief   SliceScheduler arbitrates a shared pool of Slice cores among
+  *          several Pipelines running under a single mpiexec.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#include <cstdlib>
+
+#include "lsst/pex/mpiharness/SliceScheduler.h"
+
+using lsst::pex::logging::Log;
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/** Constructor.
+ */
+SliceScheduler::SliceScheduler()
+    : capacity(0), reserve(0), freeSlices(0), nTenants(0), nDone(0), _logutils(LogUtils())
+{ }
+
+/** Destructor.
+ */
+SliceScheduler::~SliceScheduler(void) {
+}
+
+/** Split MPI_COMM_WORLD into one communicator per MPMD application and find
+ * the SliceScheduler, if one was launched.  This is collective over
+ * MPI_COMM_WORLD and is called by every Pipeline rank as well as by the
+ * SliceScheduler itself.
+ * @param isScheduler    true only when called from the SliceScheduler
+ * @param localComm      returns the communicator of the calling application
+ * @param schedulerRank  returns the MPI_COMM_WORLD rank of the SliceScheduler,
+ *                          or -1 if none is running
+ * @param nTenants       returns the number of Pipelines sharing the Slice pool
+ * @return the MPI error code of the first failing call, or MPI_SUCCESS
+ */
+int SliceScheduler::locate(bool isScheduler, MPI_Comm* localComm,
+                           int* schedulerRank, int* nTenants) {
+    int err;
+    int worldRank;
+    int localRank;
+
+    err = MPI_Comm_rank(MPI_COMM_WORLD, &worldRank);
+    if (err != MPI_SUCCESS) {
+        return err;
+    }
+
+    int flag;
+    int *appnump;
+    int color = 0;
+    err = MPI_Attr_get(MPI_COMM_WORLD, MPI_APPNUM, &appnump, &flag);
+    if (err != MPI_SUCCESS) {
+        return err;
+    }
+    if (flag) {
+        color = *appnump;
+    }
+
+    err = MPI_Comm_split(MPI_COMM_WORLD, color, worldRank, localComm);
+    if (err != MPI_SUCCESS) {
+        return err;
+    }
+
+    err = MPI_Comm_rank(*localComm, &localRank);
+    if (err != MPI_SUCCESS) {
+        return err;
+    }
+
+    int candidate = isScheduler ? worldRank : -1;
+    err = MPI_Allreduce(&candidate, schedulerRank, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
+    if (err != MPI_SUCCESS) {
+        return err;
+    }
+
+    int isTenant = (!isScheduler && localRank == 0) ? 1 : 0;
+    err = MPI_Allreduce(&isTenant, nTenants, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    return err;
+}
+
+/** Initialize the environment of the SliceScheduler.
+ */
+void SliceScheduler::initialize() {
+
+    initializeMPI();
+
+    return;
+}
+
+/** Initialize the MPI environment of the SliceScheduler.  Unless set
+ * explicitly, the capacity of the pool is the universe size less the
+ * processes started by mpiexec.
+ */
+void SliceScheduler::initializeMPI() {
+
+    mpiError = MPI_Init(NULL, NULL);
+    if (mpiError != MPI_SUCCESS) {
+        MPI_Finalize();
+        exit(1);
+    }
+
+    mpiError = MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    mpiError = MPI_Comm_size(MPI_COMM_WORLD, &size);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    int flag;
+    int *universeSizep;
+    mpiError = MPI_Attr_get(MPI_COMM_WORLD, MPI_UNIVERSE_SIZE, &universeSizep, &flag);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+    universeSize = *universeSizep;
+
+    int schedulerRank;
+    mpiError = locate(true, &localComm, &schedulerRank, &nTenants);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+
+    if (capacity <= 0) {
+        capacity = universeSize - size;
+    }
+    if (capacity < 1) {
+        capacity = 1;
+    }
+    freeSlices = capacity;
+    if (reserve >= capacity) {
+        reserve = capacity - 1;
+    }
+
+    Log log(_logutils.getLogger(), "SliceScheduler.initialize");
+    log.log(Log::INFO,
+        boost::format("Scheduling %d Pipelines on a pool of %d Slices, %d reserved for urgent visits") 
+        % nTenants % capacity % reserve);
+
+    return;
+}
+
+/** Serve requests from the Pipelines until every one of them has shut down.
+ */
+void SliceScheduler::run() {
+
+    int msg[3];
+    MPI_Status status;
+
+    while (nDone < nTenants) {
+        mpiError = MPI_Recv(msg, 3, MPI_INT, MPI_ANY_SOURCE, SCHEDULER_TAG,
+                            MPI_COMM_WORLD, &status);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+
+        switch (msg[0]) {
+          case SCHEDULER_REGISTER:
+            handleRegister(status.MPI_SOURCE, msg[1], msg[2]);
+            break;
+          case SCHEDULER_ACQUIRE:
+            handleAcquire(status.MPI_SOURCE, msg[1]);
+            break;
+          case SCHEDULER_RELEASE:
+            handleRelease(status.MPI_SOURCE);
+            break;
+          case SCHEDULER_DONE:
+            handleDone(status.MPI_SOURCE);
+            break;
+          default:
+            break;
+        }
+
+        dispatch();
+    }
+
+    return;
+}
+
+/** Shutdown the SliceScheduler by calling MPI_Finalize and then exit().
+ */
+void SliceScheduler::shutdown() {
+
+    MPI_Finalize();
+    exit(0);
+}
+
+/** set method for the number of Slice cores in the shared pool.  Must be
+ * called before initialize() to take effect.
+ */
+void SliceScheduler::setCapacity(int capacity) {
+    this->capacity = capacity;
+}
+
+/** get method for the number of Slice cores in the shared pool.
+ */
+int SliceScheduler::getCapacity() {
+    return capacity;
+}
+
+/** set method for the number of Slice cores of the pool held back for 
+ * Pipelines working on visits of priority above 0.  Must be called before
+ * initialize() to take effect.
+ */
+void SliceScheduler::setReserve(int reserve) {
+    this->reserve = (reserve > 0) ? reserve : 0;
+}
+
+/** get method for the number of Slice cores held back for urgent visits.
+ */
+int SliceScheduler::getReserve() {
+    return reserve;
+}
+
+/** Look up the tenant record of a Pipeline, adding an unregistered one
+ * that asks for the whole pool.
+ */
+SliceScheduler::Tenant& SliceScheduler::findTenant(int rank) {
+    std::vector<Tenant>::iterator iter;
+    for (iter = _tenants.begin(); iter != _tenants.end(); iter++) {
+        if (iter->rank == rank) {
+            return *iter;
+        }
+    }
+
+    Tenant tenant;
+    tenant.rank = rank;
+    tenant.nSlices = capacity;
+    tenant.weight = 1;
+    tenant.priority = 0;
+    tenant.waiting = false;
+    tenant.running = false;
+    tenant.done = false;
+    tenant.virtualTime = minimumVirtualTime();
+    tenant.grantTime = 0.0;
+    _tenants.push_back(tenant);
+    return _tenants.back();
+}
+
+/** Return the least virtual time among the tenants still running.  New and
+ * newly waiting tenants start from here so that idle time is not banked.
+ */
+double SliceScheduler::minimumVirtualTime() {
+    bool found = false;
+    double vt = 0.0;
+    std::vector<Tenant>::iterator iter;
+    for (iter = _tenants.begin(); iter != _tenants.end(); iter++) {
+        if (iter->done || !(iter->waiting || iter->running)) {
+            continue;
+        }
+        if (!found || iter->virtualTime < vt) {
+            vt = iter->virtualTime;
+            found = true;
+        }
+    }
+    return vt;
+}
+
+/** Record the slice count and weight of a Pipeline and acknowledge with the
+ * capacity of the pool.
+ */
+void SliceScheduler::handleRegister(int rank, int nSlices, int weight) {
+
+    Tenant& tenant = findTenant(rank);
+    tenant.nSlices = (nSlices > capacity) ? capacity : nSlices;
+    tenant.weight = (weight > 0) ? weight : 1;
+
+    Log log(_logutils.getLogger(), "SliceScheduler.register");
+    log.log(Log::INFO,
+        boost::format("Pipeline rank %d registered: %d Slices weight %d ") % rank % nSlices % tenant.weight);
+
+    mpiError = MPI_Send(&capacity, 1, MPI_INT, rank, SCHEDULER_TAG, MPI_COMM_WORLD);
+    if (mpiError != MPI_SUCCESS){
+        MPI_Finalize();
+        exit(1);
+    }
+}
+
+/** Queue a Pipeline that wants to run a parallel Stage of a visit of the 
+ * given priority.
+ */
+void SliceScheduler::handleAcquire(int rank, int priority) {
+
+    Tenant& tenant = findTenant(rank);
+    tenant.priority = priority;
+    double vt = minimumVirtualTime();
+    if (tenant.virtualTime < vt) {
+        tenant.virtualTime = vt;
+    }
+    tenant.waiting = true;
+}
+
+/** Return the cores of a Pipeline to the pool and charge it for their use.
+ */
+void SliceScheduler::handleRelease(int rank) {
+
+    Tenant& tenant = findTenant(rank);
+    if (!tenant.running) {
+        return;
+    }
+
+    double elapsed = MPI_Wtime() - tenant.grantTime;
+    tenant.virtualTime += (tenant.nSlices * elapsed) / tenant.weight;
+    tenant.running = false;
+    freeSlices += tenant.nSlices;
+}
+
+/** Retire a Pipeline that is shutting down.
+ */
+void SliceScheduler::handleDone(int rank) {
+
+    Tenant& tenant = findTenant(rank);
+    handleRelease(rank);
+    tenant.waiting = false;
+    if (!tenant.done) {
+        tenant.done = true;
+        nDone++;
+    }
+}
+
+/** Grant the pool to waiting Pipelines in order of priority, then of 
+ * virtual time, for as long as the next one fits into the free cores.  
+ * Visits of priority 0 or less leave the reserve free; a Pipeline too wide
+ * for the rest of the pool waits until the whole pool is free.
+ */
+void SliceScheduler::dispatch() {
+
+    while (true) {
+        Tenant* next = NULL;
+        std::vector<Tenant>::iterator iter;
+        for (iter = _tenants.begin(); iter != _tenants.end(); iter++) {
+            if (!iter->waiting) {
+                continue;
+            }
+            if (next == NULL || iter->priority > next->priority ||
+                (iter->priority == next->priority && iter->virtualTime < next->virtualTime)) {
+                next = &(*iter);
+            }
+        }
+
+        if (next == NULL) {
+            break;
+        }
+        int available = freeSlices;
+        if (next->priority <= 0 && (next->nSlices <= capacity - reserve || freeSlices < capacity)) {
+            available -= reserve;
+        }
+        if (next->nSlices > available) {
+            break;
+        }
+
+        freeSlices -= next->nSlices;
+        next->waiting = false;
+        next->running = true;
+        next->grantTime = MPI_Wtime();
+
+        mpiError = MPI_Send(&(next->nSlices), 1, MPI_INT, next->rank, SCHEDULER_TAG, MPI_COMM_WORLD);
+        if (mpiError != MPI_SUCCESS){
+            MPI_Finalize();
+            exit(1);
+        }
+    }
+}
+
+}
+}
+}
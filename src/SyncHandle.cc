@@ -0,0 +1,206 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file SyncHandle.cc
+  *
+  * \ingroup mpiharness
+  *
+  * \brief   SyncHandle tracks an interSlice exchange started by
+  *          Slice::startSyncSlices().
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#include <boost/bind.hpp>
+
+#include "lsst/pex/mpiharness/SyncHandle.h"
+#include "lsst/pex/mpiharness/TraceBuffer.h"
+#include "lsst/pex/exceptions.h"
+
+using lsst::daf::base::PropertySet;
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+/**
+ * Constructor.  The Slice starts each exchange on the plan, then begin()s it
+ * on the handle.
+ * @param rank            the rank of the Slice that runs the exchanges
+ * @param plan            the ExchangePlan the exchanges run on
+ */
+SyncHandle::SyncHandle(int rank, ExchangePlan::Ptr plan)
+    : _plan(plan), _neighborCache(0), _rank(rank), _exchanging(false), _polling(false),
+      _stopping(false), _result(new PropertySet)
+{ }
+
+/** Destructor.  The progress thread is stopped and outstanding requests
+ * are completed first, as MPI requires.
+ */
+SyncHandle::~SyncHandle(void) {
+    if (_progressThread) {
+        {
+            boost::lock_guard<boost::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _wake.notify_one();
+        _progressThread->join();
+    }
+    wait();
+}
+
+/** Follow an exchange just started on the plan.
+ * @param neighborCache   in incremental mode, the Slice's copies of the 
+ *                        PropertySets last received from each neighbor
+ * @param interval        progress the exchange from a background thread 
+ *                        every interval seconds; only valid at the 
+ *                        MPI_THREAD_MULTIPLE thread level.  0 leaves it to
+ *                        test().
+ */
+void SyncHandle::begin(std::map<int, PropertySet::Ptr>* neighborCache, double interval) {
+
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        _neighborCache = neighborCache;
+        _exchanging = true;
+        _polling = (interval > 0.0);
+    }
+
+    if (interval > 0.0) {
+        if (!_progressThread) {
+            _progressThread.reset(
+                new boost::thread(boost::bind(&SyncHandle::progressLoop, this, interval)));
+        }
+        _wake.notify_one();
+    }
+}
+
+/** Progress the exchange without blocking.
+ * @return true once all sends and receives have completed
+ */
+bool SyncHandle::test() {
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    return progress();
+}
+
+/** Block until the exchange has completed.
+ * @return A smart pointer to the PropertySet of values received from the
+ *         neighbor Slices, keyed by "neighbor-<rank>"; it is refilled by 
+ *         the next exchange
+ */
+PropertySet::Ptr SyncHandle::wait() {
+
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _polling = false;
+    if (!_exchanging) {
+        return _result;
+    }
+
+    _plan->wait();
+
+    /* Combine the received PropertySets into the result */
+    for (int i = 0; i < _plan->getRecvCount(); i++) {
+        Payload::Buffer& buffer = _plan->getArchiveBuffer();
+        buffer.clear();
+        boost::mpi::packed_iarchive archive(_plan->getCommunicator(), buffer);
+        _plan->getReceived(i).unpack(archive);
+        archive >> _update;
+
+        PropertySet::Ptr neighborPtr = _update.values;
+        if (_neighborCache != 0) {
+            neighborPtr = applyUpdate(_plan->getRecvNeighbor(i), _update);
+        }
+
+        _result->set<PropertySet::Ptr>(_plan->getRecvKey(i), neighborPtr);
+    }
+    _exchanging = false;
+
+    TraceBuffer::getInstance().record(TRACE_SYNC_END, _rank, 0, 
+                                      _plan->getSendCount() + _plan->getRecvCount());
+
+    return _result;
+}
+
+/** Patch the copy of a neighbor's PropertySet with an incremental update,
+ * touching only the parameters that changed.
+ * @return the patched PropertySet itself, which the Stage must not modify
+ *         and which holds until the next exchange
+ * @throw lsst::pex::exceptions::LogicErrorException if no full update was
+ *        received from the neighbor first
+ */
+PropertySet::Ptr SyncHandle::applyUpdate(int neighbor, const SyncUpdate& update) {
+
+    PropertySet::Ptr& cached = (*_neighborCache)[neighbor];
+    if (update.full) {
+        cached = update.values;
+    }
+    else {
+        if (!cached) {
+            throw LSST_EXCEPT(lsst::pex::exceptions::LogicErrorException,
+                              "Incremental syncSlices update without a previous exchange");
+        }
+        for (unsigned int i = 0; i < update.removed.size(); i++) {
+            cached->remove(update.removed[i]);
+        }
+        std::vector<std::string> names = update.values->paramNames(false);
+        for (unsigned int i = 0; i < names.size(); i++) {
+            cached->copy(names[i], update.values, names[i]);
+        }
+    }
+    return cached;
+}
+
+/** Test the outstanding requests once.  The caller holds the mutex.
+ */
+bool SyncHandle::progress() {
+    return !_exchanging || _plan->test();
+}
+
+/** Main loop of the progress thread: progress each exchange every interval
+ * seconds until it completes, and sleep between exchanges.
+ */
+void SyncHandle::progressLoop(double interval) {
+
+    boost::posix_time::microseconds pause(static_cast<long>(interval * 1.0e6));
+    while (true) {
+        {
+            boost::unique_lock<boost::mutex> lock(_mutex);
+            while (!_stopping && !_polling) {
+                _wake.wait(lock);
+            }
+            if (_stopping) {
+                return;
+            }
+            if (progress()) {
+                _polling = false;
+                continue;
+            }
+        }
+        boost::this_thread::sleep(pause);
+    }
+}
+
+}
+}
+}
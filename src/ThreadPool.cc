@@ -0,0 +1,244 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file ThreadPool.cc
+  *
+  * \ingroup mpiharness
+  *
+  * \brief   ThreadPool runs Tasks on worker threads within a single Slice.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#include <exception>
+
+#include <boost/bind.hpp>
+
+#include "lsst/pex/mpiharness/ThreadPool.h"
+#include "lsst/pex/exceptions.h"
+
+namespace pexExcept = lsst::pex::exceptions;
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+boost::thread_specific_ptr<std::pair<ThreadPool*, int> > ThreadPool::_worker;
+ThreadPool::Ptr ThreadPool::_default;
+
+/**
+ * Constructor.
+ * @param nThreads   the total number of threads, including the one that
+ *                     calls wait()
+ */
+ThreadPool::ThreadPool(int nThreads)
+    : _nThreads(nThreads < 1 ? 1 : nThreads), _nextQueue(0), _queued(0), _pending(0),
+      _stopping(false)
+{
+    for (int i = 0; i < _nThreads; i++) {
+        _queues.push_back(new WorkQueue());
+    }
+    for (int i = 1; i < _nThreads; i++) {
+        _threads.create_thread(boost::bind(&ThreadPool::workerLoop, this, i));
+    }
+}
+
+/** Destructor.
+ */
+ThreadPool::~ThreadPool(void) {
+    stop();
+    for (unsigned int i = 0; i < _queues.size(); i++) {
+        delete _queues[i];
+    }
+}
+
+/** Queue a Task for execution.  Returns immediately.
+ */
+void ThreadPool::submit(Task::Ptr task //!< The Task to run
+                        ) {
+    int index;
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        std::pair<ThreadPool*, int>* worker = _worker.get();
+        if (worker != NULL && worker->first == this) {
+            index = worker->second;
+        }
+        else {
+            index = _nextQueue;
+            _nextQueue = (_nextQueue + 1) % _nThreads;
+        }
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(_queues[index]->mutex);
+        _queues[index]->tasks.push_back(task);
+    }
+
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    _queued++;
+    _pending++;
+    _workReady.notify_one();
+}
+
+/** Run queued Tasks on the calling thread until none are left, then block
+ * until those taken by the workers have completed as well.
+ * @throw lsst::pex::exceptions::RuntimeErrorException if any Task failed
+ */
+void ThreadPool::wait() {
+
+    Task::Ptr task;
+    while (take(0, task)) {
+        execute(task);
+        task.reset();
+    }
+
+    boost::unique_lock<boost::mutex> lock(_mutex);
+    while (_pending > 0) {
+        _allDone.wait(lock);
+    }
+
+    if (!_failure.empty()) {
+        std::string failure = _failure;
+        _failure.clear();
+        throw LSST_EXCEPT(pexExcept::RuntimeErrorException, "ThreadPool task failed: " + failure);
+    }
+}
+
+/** Stop and join the worker threads.  Tasks still queued are left for the
+ * thread that next calls wait().
+ */
+void ThreadPool::stop() {
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        if (_stopping) {
+            return;
+        }
+        _stopping = true;
+        _workReady.notify_all();
+    }
+    _threads.join_all();
+}
+
+/** set the pool that Stages obtain through getDefault(); the Slice
+ * registers its own pool here.
+ */
+void ThreadPool::setDefault(Ptr pool) {
+    _default = pool;
+}
+
+/** get the pool of the current Slice, creating a single-threaded one if
+ * none has been set.
+ */
+ThreadPool::Ptr ThreadPool::getDefault() {
+    if (!_default) {
+        _default.reset(new ThreadPool(1));
+    }
+    return _default;
+}
+
+/** Take a Task from the given thread's own deque (newest first) or else
+ * steal one from another thread's deque (oldest first).
+ * @return false if every deque is empty
+ */
+bool ThreadPool::take(int index, Task::Ptr& task) {
+
+    bool found = false;
+    {
+        boost::lock_guard<boost::mutex> lock(_queues[index]->mutex);
+        if (!_queues[index]->tasks.empty()) {
+            task = _queues[index]->tasks.back();
+            _queues[index]->tasks.pop_back();
+            found = true;
+        }
+    }
+
+    for (int i = 1; !found && i < _nThreads; i++) {
+        WorkQueue* victim = _queues[(index + i) % _nThreads];
+        boost::lock_guard<boost::mutex> lock(victim->mutex);
+        if (!victim->tasks.empty()) {
+            task = victim->tasks.front();
+            victim->tasks.pop_front();
+            found = true;
+        }
+    }
+
+    if (found) {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        _queued--;
+    }
+    return found;
+}
+
+/** Run a Task, recording the first failure for wait() to report.
+ */
+void ThreadPool::execute(Task::Ptr task) {
+
+    std::string failure;
+    try {
+        task->run();
+    }
+    catch (std::exception& e) {
+        failure = e.what();
+    }
+    catch (...) {
+        failure = "unknown exception";
+    }
+
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    if (!failure.empty() && _failure.empty()) {
+        _failure = failure;
+    }
+    _pending--;
+    if (_pending == 0) {
+        _allDone.notify_all();
+    }
+}
+
+/** Main loop of a worker thread.
+ */
+void ThreadPool::workerLoop(int index) {
+
+    _worker.reset(new std::pair<ThreadPool*, int>(this, index));
+
+    Task::Ptr task;
+    while (true) {
+        if (take(index, task)) {
+            execute(task);
+            task.reset();
+            continue;
+        }
+
+        boost::unique_lock<boost::mutex> lock(_mutex);
+        while (_queued == 0 && !_stopping) {
+            _workReady.wait(lock);
+        }
+        if (_stopping) {
+            return;
+        }
+    }
+}
+
+}
+}
+}
@@ -0,0 +1,168 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file TraceBuffer.cc
+  *
+  * \ingroup mpiharness
+  *
+  * \brief   TraceBuffer records harness events in a binary ring buffer.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#include <fstream>
+#include <sstream>
+
+#include <boost/format.hpp>
+
+#include "mpi.h"
+
+#include "lsst/pex/mpiharness/TraceBuffer.h"
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+namespace {
+    const char* const eventNames[] = {
+        "unknown",
+        "bcast-begin", "bcast-end",
+        "barrier-begin", "barrier-end",
+        "sync-begin", "sync-posted", "sync-end",
+        "process-begin", "process-end",
+        "speculate-run", "speculate-cancel",
+        "visit-begin",
+        "preprocess-begin", "preprocess-end",
+        "postprocess-begin", "postprocess-end",
+        "unit-done",
+        "sync-diff"
+    };
+}
+
+/**
+ * Constructor.
+ * @param capacity   the number of records kept, rounded up to a power of two
+ */
+TraceBuffer::TraceBuffer(unsigned int capacity)
+    : _mask(0), _next(0), _enabled(true)
+{
+    unsigned int size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    _mask = size - 1;
+
+    TraceRecord empty = { 0.0, 0, 0, 0, 0, 0, 0 };
+    _records.assign(size, empty);
+}
+
+/** Record an event.  Safe to call from several threads at once.
+ */
+void TraceBuffer::record(int event, int rank, int stage, int arg1, int arg2) {
+
+    if (!_enabled) {
+        return;
+    }
+
+    unsigned int position = __sync_fetch_and_add(&_next, 1);
+    TraceRecord& rec = _records[position & _mask];
+
+    rec.sequence = 0;
+    __sync_synchronize();
+    rec.time = MPI_Wtime();
+    rec.event = event;
+    rec.rank = rank;
+    rec.stage = stage;
+    rec.arg1 = arg1;
+    rec.arg2 = arg2;
+    __sync_synchronize();
+    rec.sequence = position + 1;
+}
+
+/** Write the records, oldest first, one per line.  Records that are being
+ * overwritten while the dump runs are skipped.
+ * @param maxRecords   write only the most recent records; 0 for all
+ */
+void TraceBuffer::dump(std::ostream& os, unsigned int maxRecords) const {
+
+    unsigned int end = _next;
+    unsigned int size = _mask + 1;
+    if (maxRecords > 0 && maxRecords < size) {
+        size = maxRecords;
+    }
+    unsigned int begin = (end > size) ? end - size : 0;
+
+    for (unsigned int position = begin; position != end; position++) {
+        const TraceRecord& rec = _records[position & _mask];
+        if (rec.sequence != position + 1) {
+            continue;
+        }
+        os << boost::format("%.6f %-14s rank %d stage %d %d %d\n")
+            % rec.time % getEventName(rec.event) % rec.rank % rec.stage % rec.arg1 % rec.arg2;
+    }
+}
+
+/** Write the records to the named file.
+ */
+void TraceBuffer::dump(const std::string& filename) const {
+    std::ofstream os(filename.c_str());
+    dump(os);
+}
+
+/** Return the records formatted as by dump().
+ */
+std::string TraceBuffer::toString(unsigned int maxRecords) const {
+    std::ostringstream os;
+    dump(os, maxRecords);
+    return os.str();
+}
+
+/** Discard all records.
+ */
+void TraceBuffer::clear() {
+    for (unsigned int i = 0; i < _records.size(); i++) {
+        _records[i].sequence = 0;
+    }
+    _next = 0;
+}
+
+/** get the TraceBuffer of this process
+ */
+TraceBuffer& TraceBuffer::getInstance() {
+    static TraceBuffer instance;
+    return instance;
+}
+
+/** get the printable name of a TraceEvent
+ */
+const char* TraceBuffer::getEventName(int event) {
+    if (event <= 0 || event >= TRACE_EVENT_MAX) {
+        return eventNames[0];
+    }
+    return eventNames[event];
+}
+
+}
+}
+}
@@ -0,0 +1,293 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file VisitFile.cc
+  *
+  * \ingroup mpiharness
+  *
+  * \brief   VisitFile writes the fixed-size records of all Slices into one
+  *          shared file with collective MPI-IO; VisitFileReader maps it.
+  *
+  * \author  Greg Daues, NCSA
+  */
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lsst/pex/mpiharness/VisitFile.h"
+#include "lsst/pex/exceptions.h"
+
+namespace pexExcept = lsst::pex::exceptions;
+
+namespace lsst {
+namespace pex {
+namespace mpiharness {
+
+namespace {
+    const char visitFileMagic[8] = { 'M', 'P', 'I', 'H', 'V', 'I', 'S', '1' };
+    const int visitFileFixedHeader = 16;
+
+    /* Throw an IoErrorException describing an MPI-IO failure */
+    void checkMpiIo(int mpiError, const std::string& what, const std::string& filename) {
+        if (mpiError == MPI_SUCCESS) {
+            return;
+        }
+        char message[MPI_MAX_ERROR_STRING];
+        int length;
+        MPI_Error_string(mpiError, message, &length);
+        throw LSST_EXCEPT(pexExcept::IoErrorException,
+                          what + " " + filename + ": " + std::string(message, length));
+    }
+}
+
+MPI_Comm VisitFile::_defaultComm = MPI_COMM_NULL;
+
+/**
+ * Constructor.  Collective over the Slices: every Slice must construct the
+ * VisitFile with the same arguments.  An existing file is truncated.
+ * @param filename     the name of the shared file
+ * @param recordSize   the size of a record in bytes
+ * @throw lsst::pex::exceptions::IoErrorException if the file cannot be opened
+ */
+VisitFile::VisitFile(const std::string& filename, int recordSize)
+    : _recordSize(recordSize), _nRecords(0), _written(false), _file(MPI_FILE_NULL),
+      _comm(_defaultComm), _filename(filename)
+{
+    if (_comm == MPI_COMM_NULL) {
+        throw LSST_EXCEPT(pexExcept::LogicErrorException,
+                          "VisitFile used outside of an initialized Slice");
+    }
+    if (recordSize <= 0) {
+        throw LSST_EXCEPT(pexExcept::InvalidParameterException,
+                          "VisitFile record size must be positive");
+    }
+
+    checkMpiIo(MPI_File_open(_comm, const_cast<char*>(filename.c_str()),
+                             MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &_file),
+               "Cannot open", filename);
+    checkMpiIo(MPI_File_set_size(_file, 0), "Cannot truncate", filename);
+}
+
+/** Destructor.  Closes the file if close() has not been called; as this is
+ * collective, Stages should call close() rather than rely on it.
+ */
+VisitFile::~VisitFile(void) {
+    if (_file != MPI_FILE_NULL) {
+        MPI_File_close(&_file);
+    }
+}
+
+/** Write this Slice's records; see write(const void*, long long).
+ * @param records   the records, packed back to back
+ */
+void VisitFile::write(const std::string& records) {
+    if (records.size() % _recordSize != 0) {
+        throw LSST_EXCEPT(pexExcept::InvalidParameterException,
+                          "VisitFile data is not a whole number of records");
+    }
+    write(records.data(), records.size() / _recordSize);
+}
+
+/** Write this Slice's records.  Collective: every Slice calls write() once,
+ * with as many records as it has, possibly none.  Slice 0 writes the header
+ * in the same pass.
+ * @param records    the records, packed back to back
+ * @param nRecords   the number of records
+ * @throw lsst::pex::exceptions::IoErrorException if the write fails
+ */
+void VisitFile::write(const void* records, long long nRecords) {
+
+    if (_written) {
+        throw LSST_EXCEPT(pexExcept::LogicErrorException,
+                          "VisitFile " + _filename + " has already been written");
+    }
+    _written = true;
+
+    int rank, size;
+    MPI_Comm_rank(_comm, &rank);
+    MPI_Comm_size(_comm, &size);
+
+    long long firstRecord = 0;
+    MPI_Exscan(&nRecords, &firstRecord, 1, MPI_LONG_LONG, MPI_SUM, _comm);
+    if (rank == 0) {
+        firstRecord = 0;
+    }
+
+    std::vector<long long> counts(rank == 0 ? size : 1);
+    MPI_Gather(&nRecords, 1, MPI_LONG_LONG, &counts[0], 1, MPI_LONG_LONG, 0, _comm);
+    MPI_Allreduce(&nRecords, &_nRecords, 1, MPI_LONG_LONG, MPI_SUM, _comm);
+
+    MPI_Offset headerSize = visitFileFixedHeader + sizeof(long long) * (size + 1);
+    std::vector<char> header;
+    if (rank == 0) {
+        header.resize(headerSize);
+        std::memcpy(&header[0], visitFileMagic, sizeof(visitFileMagic));
+        std::memcpy(&header[8], &size, sizeof(int));
+        std::memcpy(&header[12], &_recordSize, sizeof(int));
+        long long first = 0;
+        for (int i = 0; i <= size; i++) {
+            std::memcpy(&header[visitFileFixedHeader + i * sizeof(long long)],
+                        &first, sizeof(long long));
+            if (i < size) {
+                first += counts[i];
+            }
+        }
+    }
+
+    MPI_Status status;
+    checkMpiIo(MPI_File_write_at_all(_file, 0, header.empty() ? NULL : &header[0],
+                                     header.size(), MPI_BYTE, &status),
+               "Cannot write the header of", _filename);
+
+    MPI_Datatype recordType;
+    MPI_Type_contiguous(_recordSize, MPI_BYTE, &recordType);
+    MPI_Type_commit(&recordType);
+
+    int mpiError = MPI_File_write_at_all(_file, headerSize + firstRecord * _recordSize,
+                                         const_cast<void*>(records), static_cast<int>(nRecords),
+                                         recordType, &status);
+    MPI_Type_free(&recordType);
+    checkMpiIo(mpiError, "Cannot write the records of", _filename);
+}
+
+/** Close the file.  Collective.
+ */
+void VisitFile::close() {
+    if (_file != MPI_FILE_NULL) {
+        checkMpiIo(MPI_File_close(&_file), "Cannot close", _filename);
+    }
+}
+
+/** set the communicator of the Slices that VisitFiles are opened on; the
+ * Slice registers a duplicate of its world communicator here.
+ */
+void VisitFile::setCommunicator(MPI_Comm comm) {
+    _defaultComm = comm;
+}
+
+/**
+ * Constructor.  Maps the whole file read-only.
+ * @param filename   the name of a file written by VisitFile
+ * @throw lsst::pex::exceptions::IoErrorException if the file cannot be
+ *        mapped or is not a VisitFile
+ */
+VisitFileReader::VisitFileReader(const std::string& filename)
+    : _filename(filename), _map(NULL), _length(0), _nSlices(0), _recordSize(0),
+      _firstRecord(NULL), _data(NULL)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw LSST_EXCEPT(pexExcept::IoErrorException, "Cannot open " + filename);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < visitFileFixedHeader) {
+        ::close(fd);
+        throw LSST_EXCEPT(pexExcept::IoErrorException, "Not a VisitFile: " + filename);
+    }
+    _length = st.st_size;
+
+    void* map = mmap(NULL, _length, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        throw LSST_EXCEPT(pexExcept::IoErrorException, "Cannot map " + filename);
+    }
+    _map = static_cast<char*>(map);
+
+    std::memcpy(&_nSlices, _map + 8, sizeof(int));
+    std::memcpy(&_recordSize, _map + 12, sizeof(int));
+
+    size_t headerSize = visitFileFixedHeader + sizeof(long long) * (_nSlices + 1);
+    if (std::memcmp(_map, visitFileMagic, sizeof(visitFileMagic)) != 0 ||
+        _nSlices <= 0 || _recordSize <= 0 || _length < headerSize) {
+        munmap(_map, _length);
+        throw LSST_EXCEPT(pexExcept::IoErrorException, "Not a VisitFile: " + filename);
+    }
+
+    _firstRecord = reinterpret_cast<const long long*>(_map + visitFileFixedHeader);
+    _data = _map + headerSize;
+
+    /* The offsets of the Slices start at 0 and never decrease */
+    bool ordered = (_firstRecord[0] == 0);
+    for (int i = 0; ordered && i < _nSlices; i++) {
+        ordered = (_firstRecord[i] <= _firstRecord[i + 1]);
+    }
+    if (!ordered) {
+        munmap(_map, _length);
+        throw LSST_EXCEPT(pexExcept::IoErrorException, "Corrupt VisitFile header: " + filename);
+    }
+
+    if (_firstRecord[_nSlices] > static_cast<long long>((_length - headerSize) / _recordSize)) {
+        munmap(_map, _length);
+        throw LSST_EXCEPT(pexExcept::IoErrorException, "Truncated VisitFile: " + filename);
+    }
+}
+
+/** Destructor.  Unmaps the file.
+ */
+VisitFileReader::~VisitFileReader(void) {
+    munmap(_map, _length);
+}
+
+/** get the number of records of all Slices
+ */
+long long VisitFileReader::getRecordCount() {
+    return _firstRecord[_nSlices];
+}
+
+/** get the number of records written by a Slice
+ */
+long long VisitFileReader::getRecordCount(int slice) {
+    checkSlice(slice);
+    return _firstRecord[slice + 1] - _firstRecord[slice];
+}
+
+/** get the records written by a Slice, in place in the mapping
+ */
+const char* VisitFileReader::getRecordData(int slice) {
+    checkSlice(slice);
+    return _data + _firstRecord[slice] * _recordSize;
+}
+
+/** get a copy of the records written by a Slice
+ */
+std::string VisitFileReader::getRecords(int slice) {
+    return std::string(getRecordData(slice), getRecordCount(slice) * _recordSize);
+}
+
+/** Throw a RangeErrorException if there is no such Slice
+ */
+void VisitFileReader::checkSlice(int slice) {
+    if (slice < 0 || slice >= _nSlices) {
+        throw LSST_EXCEPT(pexExcept::RangeErrorException, "No such Slice in " + _filename);
+    }
+}
+
+}
+}
+}
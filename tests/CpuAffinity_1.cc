@@ -0,0 +1,115 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file CpuAffinity_1.cc
+  *
+  * \brief   Tests of the core placement strategies of CpuAffinity and of 
+  *          its kernel cpu lists.
+  */
+
+#include <string>
+#include <vector>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE CpuAffinity_1
+#include "boost/test/unit_test.hpp"
+
+#include "lsst/pex/mpiharness/CpuAffinity.h"
+
+using lsst::pex::mpiharness::CpuAffinity;
+
+namespace {
+    /* Two NUMA nodes of four cores each */
+    CpuAffinity twoNodes() {
+        std::vector<std::vector<int> > nodeCpus(2);
+        for (int i = 0; i < 4; i++) {
+            nodeCpus[0].push_back(i);
+            nodeCpus[1].push_back(4 + i);
+        }
+        return CpuAffinity(nodeCpus);
+    }
+
+    std::string chosen(const CpuAffinity& affinity, const std::string& strategy, 
+                       int localRank, int localSize) {
+        return CpuAffinity::format(affinity.choose(strategy, localRank, localSize));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(compact) {
+    CpuAffinity affinity = twoNodes();
+    BOOST_CHECK_EQUAL(chosen(affinity, "compact", 0, 4), "0-1");
+    BOOST_CHECK_EQUAL(chosen(affinity, "compact", 1, 4), "2-3");
+    BOOST_CHECK_EQUAL(chosen(affinity, "compact", 2, 4), "4-5");
+    BOOST_CHECK_EQUAL(chosen(affinity, "compact", 3, 4), "6-7");
+    BOOST_CHECK_EQUAL(chosen(affinity, "compact", 0, 1), "0-7");
+
+    /* More Slices than cores share them one each */
+    BOOST_CHECK_EQUAL(chosen(affinity, "compact", 9, 16), "1");
+}
+
+BOOST_AUTO_TEST_CASE(scatter) {
+    CpuAffinity affinity = twoNodes();
+    BOOST_CHECK_EQUAL(chosen(affinity, "scatter", 0, 4), "0-1");
+    BOOST_CHECK_EQUAL(chosen(affinity, "scatter", 1, 4), "4-5");
+    BOOST_CHECK_EQUAL(chosen(affinity, "scatter", 2, 4), "2-3");
+    BOOST_CHECK_EQUAL(chosen(affinity, "scatter", 3, 4), "6-7");
+
+    /* An odd Slice count leaves the second node fewer Slices */
+    BOOST_CHECK_EQUAL(chosen(affinity, "scatter", 0, 3), "0-1");
+    BOOST_CHECK_EQUAL(chosen(affinity, "scatter", 1, 3), "4-7");
+    BOOST_CHECK_EQUAL(chosen(affinity, "scatter", 2, 3), "2-3");
+}
+
+BOOST_AUTO_TEST_CASE(numa) {
+    CpuAffinity affinity = twoNodes();
+    BOOST_CHECK_EQUAL(chosen(affinity, "numa", 0, 4), "0-3");
+    BOOST_CHECK_EQUAL(chosen(affinity, "numa", 1, 4), "4-7");
+    BOOST_CHECK_EQUAL(chosen(affinity, "numa", 2, 4), "0-3");
+    BOOST_CHECK(affinity.choose("none", 0, 4).empty());
+
+    std::vector<int> nodes = affinity.getNodes(CpuAffinity::parseList("3-4"));
+    BOOST_REQUIRE_EQUAL(nodes.size(), 2U);
+    BOOST_CHECK_EQUAL(nodes[0], 0);
+    BOOST_CHECK_EQUAL(nodes[1], 1);
+}
+
+BOOST_AUTO_TEST_CASE(strategies) {
+    BOOST_CHECK(CpuAffinity::isStrategy("none"));
+    BOOST_CHECK(CpuAffinity::isStrategy("compact"));
+    BOOST_CHECK(CpuAffinity::isStrategy("scatter"));
+    BOOST_CHECK(CpuAffinity::isStrategy("numa"));
+    BOOST_CHECK(!CpuAffinity::isStrategy("spread"));
+}
+
+BOOST_AUTO_TEST_CASE(cpuLists) {
+    std::vector<int> list = CpuAffinity::parseList("0-3,8,10-11\n");
+    int expected[] = { 0, 1, 2, 3, 8, 10, 11 };
+    BOOST_CHECK_EQUAL_COLLECTIONS(list.begin(), list.end(), expected, expected + 7);
+    BOOST_CHECK_EQUAL(CpuAffinity::format(list), "0-3,8,10-11");
+
+    const char* lists[] = { "", "5", "0-63", "0,2,4", "1-2,4-5,7" };
+    for (int i = 0; i < 5; i++) {
+        BOOST_CHECK_EQUAL(CpuAffinity::format(CpuAffinity::parseList(lists[i])), lists[i]);
+    }
+}
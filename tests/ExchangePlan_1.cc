@@ -0,0 +1,109 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file ExchangePlan_1.cc
+  *
+  * \brief   Tests that an ExchangePlan puts only the Payload on the wire,
+  *          however large an earlier Payload made its buffers.
+  */
+
+#include <list>
+#include <string>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE ExchangePlan_1
+#include "boost/test/unit_test.hpp"
+
+#include "mpi.h"
+
+#include "lsst/pex/mpiharness/ExchangePlan.h"
+
+using lsst::pex::mpiharness::ExchangePlan;
+using lsst::pex::mpiharness::Payload;
+
+namespace {
+    /* MPI for the whole test program */
+    struct MpiEnvironment {
+        MpiEnvironment() {
+            MPI_Init(NULL, NULL);
+        }
+        ~MpiEnvironment() {
+            MPI_Finalize();
+        }
+    };
+
+    /* Exchange a string of the given length with this process itself
+       @return the string received */
+    std::string exchange(ExchangePlan& plan, int length) {
+        boost::mpi::communicator self(plan.getCommunicator(), boost::mpi::comm_attach);
+
+        Payload::Buffer& buffer = plan.getArchiveBuffer();
+        buffer.clear();
+        {
+            boost::mpi::packed_oarchive archive(self, buffer);
+            archive << std::string(length, 'x');
+            plan.getSendPayload().pack(archive, -1);
+        }
+
+        plan.start();
+        plan.wait();
+
+        buffer.clear();
+        boost::mpi::packed_iarchive archive(self, buffer);
+        plan.getReceived(0).unpack(archive);
+        std::string received;
+        archive >> received;
+        return received;
+    }
+}
+
+BOOST_GLOBAL_FIXTURE(MpiEnvironment);
+
+BOOST_AUTO_TEST_CASE(wireBytes) {
+    std::list<int> self(1, 0);
+    ExchangePlan plan(MPI_COMM_SELF, self, self);
+
+    BOOST_CHECK_EQUAL(exchange(plan, 100).size(), 100U);
+    int smallSize = plan.getSendPayload().getWireSize();
+    BOOST_CHECK(smallSize < 200);
+    BOOST_CHECK_EQUAL(plan.getSentBytes(), smallSize);
+    BOOST_CHECK_EQUAL(plan.getReceivedBytes(0), smallSize);
+
+    /* Larger than the buffers: sent in two parts, after which they grow */
+    int large = 4 * ExchangePlan::INITIAL_CAPACITY;
+    BOOST_CHECK_EQUAL(exchange(plan, large).size(), static_cast<unsigned int>(large));
+    int largeSize = plan.getSendPayload().getWireSize();
+    BOOST_CHECK_EQUAL(plan.getReceivedBytes(0), largeSize);
+    BOOST_CHECK_EQUAL(plan.getRebuildCount(), 1);
+
+    /* A small Payload after the large one is not padded to the buffers */
+    BOOST_CHECK_EQUAL(exchange(plan, 100).size(), 100U);
+    BOOST_CHECK_EQUAL(plan.getSentBytes(), smallSize);
+    BOOST_CHECK_EQUAL(plan.getReceivedBytes(0), smallSize);
+
+    /* The grown buffers take the large Payload in one part */
+    BOOST_CHECK_EQUAL(exchange(plan, large).size(), static_cast<unsigned int>(large));
+    BOOST_CHECK_EQUAL(plan.getReceivedBytes(0), largeSize);
+    BOOST_CHECK_EQUAL(plan.getRebuildCount(), 1);
+}
@@ -0,0 +1,125 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file ThreadPool_1.cc
+  *
+  * \brief   Tests that Tasks run by the workers of one ThreadPool may submit 
+  *          to another pool of a different size.
+  */
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE ThreadPool_1
+#include "boost/test/unit_test.hpp"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "lsst/pex/mpiharness/ThreadPool.h"
+
+using lsst::pex::mpiharness::Task;
+using lsst::pex::mpiharness::ThreadPool;
+
+namespace {
+    /* Counts its runs */
+    class CountTask : public Task {
+    public:
+        CountTask() : _count(0) { }
+        virtual void run() {
+            boost::lock_guard<boost::mutex> lock(_mutex);
+            _count++;
+        }
+        int getCount() {
+            boost::lock_guard<boost::mutex> lock(_mutex);
+            return _count;
+        }
+    private:
+        boost::mutex _mutex;
+        int _count;
+    };
+
+    /* Submits a number of runs of a Task to a pool */
+    class ForwardTask : public CountTask {
+    public:
+        ForwardTask(ThreadPool::Ptr pool, Task::Ptr task, int count) 
+            : _pool(pool), _task(task), _count(count) { }
+        virtual void run() {
+            for (int i = 0; i < _count; i++) {
+                _pool->submit(_task);
+            }
+            CountTask::run();
+        }
+    private:
+        ThreadPool::Ptr _pool;
+        Task::Ptr _task;
+        int _count;
+    };
+
+    /* Let the workers of a pool, rather than the thread calling wait(), run
+       the forwarding Tasks */
+    void awaitWorkers(boost::shared_ptr<ForwardTask> forward, int count) {
+        while (forward->getCount() < count) {
+            boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(submitAcrossPools) {
+    /* The workers of the larger pool have deque indices the smaller lacks */
+    ThreadPool::Ptr large(new ThreadPool(8));
+    ThreadPool::Ptr small(new ThreadPool(2));
+
+    boost::shared_ptr<CountTask> count(new CountTask());
+    boost::shared_ptr<ForwardTask> forward(new ForwardTask(small, count, 50));
+    for (int i = 0; i < 40; i++) {
+        large->submit(forward);
+    }
+    awaitWorkers(forward, 40);
+    large->wait();
+    small->wait();
+    BOOST_CHECK_EQUAL(count->getCount(), 40 * 50);
+
+    /* And the other way round */
+    boost::shared_ptr<CountTask> back(new CountTask());
+    boost::shared_ptr<ForwardTask> forwardBack(new ForwardTask(large, back, 50));
+    for (int i = 0; i < 40; i++) {
+        small->submit(forwardBack);
+    }
+    awaitWorkers(forwardBack, 40);
+    small->wait();
+    large->wait();
+    BOOST_CHECK_EQUAL(back->getCount(), 40 * 50);
+}
+
+BOOST_AUTO_TEST_CASE(submitFromOwnWorkers) {
+    ThreadPool::Ptr pool(new ThreadPool(4));
+
+    boost::shared_ptr<CountTask> count(new CountTask());
+    boost::shared_ptr<ForwardTask> forward(new ForwardTask(pool, count, 50));
+    for (int i = 0; i < 40; i++) {
+        pool->submit(forward);
+    }
+    awaitWorkers(forward, 40);
+    pool->wait();
+    BOOST_CHECK_EQUAL(count->getCount(), 40 * 50);
+}
@@ -0,0 +1,159 @@
+// -*- lsst-c++ -*-
+
+/*
+ * LSST Data Management System
+ * Copyright 2008, 2009, 2010 LSST Corporation.
+ *
+ * This product includes software developed by the
+ * LSST Project (http://www.lsstcorp.org/).
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the LSST License Statement and
+ * the GNU General Public License along with this program.  If not,
+ * see <http://www.lsstcorp.org/LegalNotices/>.
+ */
+
+/** \file VisitFileReader_1.cc
+  *
+  * \brief   Tests that VisitFileReader reads the records of each Slice and 
+  *          rejects files whose header or offsets do not hold together.
+  */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MODULE VisitFileReader_1
+#include "boost/test/unit_test.hpp"
+
+#include "lsst/pex/mpiharness/VisitFile.h"
+#include "lsst/pex/exceptions.h"
+
+namespace pexExcept = lsst::pex::exceptions;
+using lsst::pex::mpiharness::VisitFileReader;
+
+namespace {
+    /* A scratch file, removed when the test is over */
+    struct ScratchFile {
+        ScratchFile() {
+            char name[] = "VisitFileReader_XXXXXX";
+            int fd = mkstemp(name);
+            BOOST_REQUIRE(fd >= 0);
+            ::close(fd);
+            filename = name;
+        }
+        ~ScratchFile() {
+            std::remove(filename.c_str());
+        }
+
+        /* Write a VisitFile header with the given offsets, then dataBytes bytes */
+        void write(const char* magic, int nSlices, int recordSize, 
+                   const std::vector<long long>& offsets, int dataBytes) {
+            std::ofstream os(filename.c_str(), std::ios::binary | std::ios::trunc);
+            os.write(magic, 8);
+            os.write(reinterpret_cast<const char*>(&nSlices), sizeof(int));
+            os.write(reinterpret_cast<const char*>(&recordSize), sizeof(int));
+            if (!offsets.empty()) {
+                os.write(reinterpret_cast<const char*>(&offsets[0]), 
+                         offsets.size() * sizeof(long long));
+            }
+            for (int i = 0; i < dataBytes; i++) {
+                os.put(static_cast<char>('a' + i % 26));
+            }
+        }
+
+        std::string filename;
+    };
+
+    const char* const magic = "MPIHVIS1";
+
+    /* The offsets of the records of three Slices, and their end */
+    std::vector<long long> offsets(long long a, long long b, long long c, long long d) {
+        std::vector<long long> list;
+        list.push_back(a);
+        list.push_back(b);
+        list.push_back(c);
+        list.push_back(d);
+        return list;
+    }
+}
+
+BOOST_FIXTURE_TEST_SUITE(VisitFileReaderSuite, ScratchFile)
+
+BOOST_AUTO_TEST_CASE(records) {
+    write(magic, 3, 4, offsets(0, 2, 2, 5), 20);
+
+    VisitFileReader reader(filename);
+    BOOST_CHECK_EQUAL(reader.getSliceCount(), 3);
+    BOOST_CHECK_EQUAL(reader.getRecordSize(), 4);
+    BOOST_CHECK_EQUAL(reader.getRecordCount(), 5);
+    BOOST_CHECK_EQUAL(reader.getRecordCount(0), 2);
+    BOOST_CHECK_EQUAL(reader.getRecordCount(1), 0);
+    BOOST_CHECK_EQUAL(reader.getRecordCount(2), 3);
+    BOOST_CHECK_EQUAL(reader.getRecords(0), "abcdefgh");
+    BOOST_CHECK_EQUAL(reader.getRecords(1), "");
+    BOOST_CHECK_EQUAL(reader.getRecords(2), "ijklmnopqrst");
+    BOOST_CHECK(std::memcmp(reader.getRecordData(2), "ijkl", 4) == 0);
+
+    BOOST_CHECK_THROW(reader.getRecordCount(3), pexExcept::RangeErrorException);
+    BOOST_CHECK_THROW(reader.getRecords(-1), pexExcept::RangeErrorException);
+}
+
+BOOST_AUTO_TEST_CASE(badHeader) {
+    BOOST_CHECK_THROW(VisitFileReader(filename + ".missing"), pexExcept::IoErrorException);
+
+    /* Shorter than the fixed header */
+    {
+        std::ofstream os(filename.c_str(), std::ios::binary | std::ios::trunc);
+        os.write(magic, 8);
+    }
+    BOOST_CHECK_THROW(VisitFileReader reader(filename), pexExcept::IoErrorException);
+
+    write("MPIHVIS0", 3, 4, offsets(0, 2, 2, 5), 20);
+    BOOST_CHECK_THROW(VisitFileReader reader(filename), pexExcept::IoErrorException);
+
+    write(magic, 0, 4, offsets(0, 2, 2, 5), 20);
+    BOOST_CHECK_THROW(VisitFileReader reader(filename), pexExcept::IoErrorException);
+
+    write(magic, 3, 0, offsets(0, 2, 2, 5), 20);
+    BOOST_CHECK_THROW(VisitFileReader reader(filename), pexExcept::IoErrorException);
+
+    /* More Slices than there are offsets in the file */
+    write(magic, 1000, 4, offsets(0, 2, 2, 5), 0);
+    BOOST_CHECK_THROW(VisitFileReader reader(filename), pexExcept::IoErrorException);
+}
+
+BOOST_AUTO_TEST_CASE(badOffsets) {
+    write(magic, 3, 4, offsets(1, 2, 2, 5), 20);
+    BOOST_CHECK_THROW(VisitFileReader reader(filename), pexExcept::IoErrorException);
+
+    write(magic, 3, 4, offsets(0, 3, 2, 5), 20);
+    BOOST_CHECK_THROW(VisitFileReader reader(filename), pexExcept::IoErrorException);
+
+    write(magic, 3, 4, offsets(0, -2, 2, 5), 20);
+    BOOST_CHECK_THROW(VisitFileReader reader(filename), pexExcept::IoErrorException);
+
+    /* The records run past the end of the file */
+    write(magic, 3, 4, offsets(0, 2, 2, 5), 19);
+    BOOST_CHECK_THROW(VisitFileReader reader(filename), pexExcept::IoErrorException);
+
+    write(magic, 3, 4, offsets(0, 2, 2, 1LL << 61), 20);
+    BOOST_CHECK_THROW(VisitFileReader reader(filename), pexExcept::IoErrorException);
+}
+
+BOOST_AUTO_TEST_SUITE_END()